@@ -31,6 +31,7 @@ int parse_cfg(FILE* cfgfile, struct config* cfg);
 	struct mouse_switch mouseswitch;
 	struct focus_target focus_target;
 	struct link link;
+	struct group_member* members;
 	struct logfile logfile;
 	struct {
 		float duration;
@@ -65,6 +66,7 @@ static struct remote* new_uninit_remote(void)
 	rmt->params = new_kvmap();
 	rmt->node.remote = rmt;
 	rmt->scrollmult = 1;
+	rmt->prot_caps = PROT_CAPS_SUPPORTED;
 
 	return rmt;
 }
@@ -80,13 +82,14 @@ static struct remote* new_uninit_remote(void)
 %token <d> DECIMAL
 %token <str> STRING
 
-%token KW_MASTER KW_REMOTE KW_TOPOLOGY
+%token KW_MASTER KW_REMOTE KW_TOPOLOGY KW_GROUP
 
 %token KW_REMOTESHELL KW_BINDADDR KW_HOTKEY KW_FOCUS KW_RECONNECT KW_SLIDE
 %token KW_IDENTITYFILE KW_PARAM KW_SHOWFOCUS KW_DIMINACTIVE KW_FLASHACTIVE
 %token KW_NONE KW_MOUSESWITCH KW_MULTITAP KW_SHOWNULLSWITCH KW_HOTKEYONLY KW_QUIT
 %token KW_PREVIOUS KW_RECONMAXINT KW_RECONMAXTRIES KW_CLEARCLIPBOARD
 %token KW_USEPRIVATEAGENT KW_SCROLLMULT KW_HALT_RECONNECTS KW_STEP_LOGLEVEL
+%token KW_LAZYCLIPBOARD KW_LEGACYPROTOCOL KW_BATCHSIZE
 
 %token KW_USER KW_HOSTNAME KW_PORT KW_REMOTECMD
 
@@ -106,6 +109,7 @@ static struct remote* new_uninit_remote(void)
 %type <dim_fade> dim_fade
 %type <focus_target> focus_target
 %type <link> link
+%type <members> group_members
 %type <dir> direction opt_direction
 %type <str> opt_string
 %type <i> loglevel
@@ -146,6 +150,8 @@ block: master_block {
 | topology_block {
 }
 | remote_block {
+}
+| group_block {
 };
 
 opt_string: EMPTY { $$ = NULL; }
@@ -302,6 +308,14 @@ master_opt: remoteshell_setting {
 | KW_USEPRIVATEAGENT EQ yesno_bool {
 	st->cfg->use_private_ssh_agent = $3;
 }
+| KW_LAZYCLIPBOARD EQ yesno_bool {
+	st->cfg->lazy_clipboard = $3;
+}
+| KW_BATCHSIZE EQ INTEGER {
+	if ($3 < 0)
+		fail_parse(st, "invalid batch-size");
+	st->cfg->batch_size = $3;
+}
 | KW_LOGFILE EQ logfile {
 	st->cfg->log.file = $3;
 }
@@ -326,6 +340,11 @@ focus_target: direction {
 }
 | KW_PREVIOUS {
 	$$.type = FT_PREVIOUS;
+}
+| KW_GROUP STRING {
+	$$.type = FT_GROUP;
+	$$.grp.name = $2;
+	$$.grp.group = NULL;
 };
 
 action: KW_FOCUS focus_target {
@@ -385,6 +404,28 @@ node: STRING {
 	$$.name = NULL;
 };
 
+group_block: KW_GROUP STRING LBRACE group_members RBRACE {
+	struct group* grp = xmalloc(sizeof(*grp));
+
+	if (!$4)
+		fail_parse(st, "empty group");
+
+	grp->name = $2;
+	grp->members = $4;
+	grp->next = st->cfg->groups;
+	st->cfg->groups = grp;
+};
+
+group_members: EMPTY {
+	$$ = NULL;
+}
+| node group_members {
+	$$ = xmalloc(sizeof(*$$));
+	$$->nr = $1;
+	$$->dropped = 0;
+	$$->next = $2;
+};
+
 remote_block: KW_REMOTE STRING remote_opts {
 	struct remote* rmt = st->nextrmt;
 
@@ -429,6 +470,9 @@ remote_opt: KW_HOSTNAME EQ STRING {
 | scrollmult_setting {
 	st->nextrmt->scrollmult = $1;
 }
+| KW_LEGACYPROTOCOL EQ yesno_bool {
+	st->nextrmt->prot_caps = $3 ? 0 : PROT_CAPS_SUPPORTED;
+}
 | KW_PARAM LBRACKET STRING RBRACKET EQ STRING {
 	kvmap_put(st->nextrmt->params, $3, $6);
 	xfree($3);
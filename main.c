@@ -27,6 +27,7 @@
 /* Default config values are zero for all but a few things. */
 static struct config global_cfg = {
 	.log.level = LL_INFO,
+	.batch_size = 1024,
 	.reconnect = {
 		.max_tries = 10,
 		.max_interval = 30 * 1000 * 1000,
@@ -36,6 +37,30 @@ static struct config* config = &global_cfg;
 
 struct node* focused_node;
 static struct node* last_focused_node;
+
+/*
+ * Group that keyboard and mouse-button input is being broadcast to (see
+ * focus_group()), or NULL if it's just going to focused_node.
+ */
+static struct group* focused_group;
+
+/*
+ * How many input events a group member other than the focused one can have
+ * waiting to be written before it's dropped from the group, so that one slow
+ * remote can't run up a send backlog (and get disconnected) while the rest
+ * keep up.
+ */
+#define GROUP_MAX_BACKLOG 16
+
+/*
+ * With lazy clipboard transfers, the remote whose clipboard the master's own
+ * is standing in for (see claim_lazy_clipboard()), and the hash of the
+ * current clipboard contents, wherever they are.
+ */
+static struct {
+	struct remote* source;
+	uint64_t hash;
+} lazyclip;
 opmode_t opmode;
 
 static char* progname;
@@ -210,6 +235,9 @@ static void disconnect_remote(struct remote* rmt)
 
 	rmt->sshpid = -1;
 
+	if (rmt == lazyclip.source)
+		lazyclip.source = NULL;
+
 	if (rmt == focused_node->remote)
 		focus_master();
 }
@@ -265,6 +293,81 @@ static void enqueue_message(struct remote* rmt, struct message* msg)
 		fail_remote(rmt, "send backlog exceeded");
 }
 
+/*
+ * Send a message (consuming it) to every remote we have a connection to or
+ * are setting one up with, serializing it only once for all of them.
+ */
+static void broadcast_message(struct message* msg)
+{
+	struct remote* rmt;
+	struct sharedmsg* sm = new_sharedmsg(msg);
+
+	for_each_remote (rmt) {
+		if (rmt->state != CS_CONNECTED && rmt->state != CS_SETTINGUP)
+			continue;
+		if (mc_enqueue_shared(&rmt->msgchan, sm))
+			fail_remote(rmt, "send backlog exceeded");
+	}
+
+	free_sharedmsg(sm);
+}
+
+static int group_member_active(const struct group_member* m)
+{
+	return m->nr.node->remote->state == CS_CONNECTED && !m->dropped;
+}
+
+/*
+ * Check whether a member of a group being broadcast to should be sent the
+ * next input event, dropping it from the group if it's fallen too far
+ * behind.  The focused member is never dropped; it just gets the usual
+ * backlog limit.
+ */
+static int group_member_ready(struct group* grp, struct group_member* m)
+{
+	struct remote* rmt = m->nr.node->remote;
+
+	if (!group_member_active(m))
+		return 0;
+
+	if (rmt != focused_node->remote
+	    && mc_input_backlog(&rmt->msgchan) >= GROUP_MAX_BACKLOG) {
+		warn("dropping %s from group '%s' (not keeping up with input)\n",
+		     rmt->node.name, grp->name);
+		m->dropped = 1;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Send an input event (consuming it) to all active members of the focused
+ * group, serializing it only once for all of them.
+ */
+static void send_group_input(struct message* msg)
+{
+	struct group_member* m;
+	struct group* grp = focused_group;
+	struct sharedmsg* sm = new_sharedmsg(msg);
+
+	/* (Stop if the focused member fails and takes the group with it.) */
+	for (m = grp->members; m && focused_group == grp; m = m->next) {
+		if (!group_member_ready(grp, m))
+			continue;
+		if (mc_enqueue_shared(&m->nr.node->remote->msgchan, sm))
+			fail_remote(m->nr.node->remote, "send backlog exceeded");
+	}
+
+	free_sharedmsg(sm);
+}
+
+/* Whether input sent to the given remote should go to the focused group. */
+static inline int group_input(const struct remote* rmt)
+{
+	return focused_group && rmt == focused_node->remote;
+}
+
 void send_keyevent(struct remote* rmt, keycode_t kc, pressrel_t pr)
 {
 	struct message* msg;
@@ -277,7 +380,10 @@ void send_keyevent(struct remote* rmt, keycode_t kc, pressrel_t pr)
 	MB(msg, keyevent).keycode = kc;
 	MB(msg, keyevent).pressrel = pr;
 
-	enqueue_message(rmt, msg);
+	if (group_input(rmt))
+		send_group_input(msg);
+	else
+		enqueue_message(rmt, msg);
 }
 
 void send_moverel(struct remote* rmt, int32_t dx, int32_t dy)
@@ -295,68 +401,148 @@ void send_moverel(struct remote* rmt, int32_t dx, int32_t dy)
 	enqueue_message(rmt, msg);
 }
 
-void send_clickevent(struct remote* rmt, mousebutton_t button, pressrel_t pr)
+static void enqueue_click(struct remote* rmt, mousebutton_t button, pressrel_t pr)
+{
+	struct message* msg = new_message(MT_CLICKEVENT);
+
+	MB(msg, clickevent).button = button;
+	MB(msg, clickevent).pressrel = pr;
+
+	enqueue_message(rmt, msg);
+}
+
+/*
+ * Scroll by the given (fractional) numbers of wheel clicks, scaled by the
+ * remote's scroll multiplier.  Remotes without PROT_CAP_SCROLL get whole
+ * clicks, with any remainder carried over to the next scroll, and no
+ * horizontal scrolling.
+ */
+static void enqueue_scroll(struct remote* rmt, float dx, float dy)
 {
 	struct message* msg;
-	unsigned int i, count = 1;
+	mousebutton_t button;
+	int clicks;
 
-	if (!rmt)
+	dx *= rmt->scrollmult;
+	dy *= rmt->scrollmult;
+
+	if (rmt->msgchan.features & PROT_CAP_SCROLL) {
+		msg = new_message(MT_SCROLL);
+
+		MB(msg, scroll).dx = dx;
+		MB(msg, scroll).dy = dy;
+
+		enqueue_message(rmt, msg);
 		return;
+	}
+
+	rmt->scroll_remainder += dy;
+	clicks = (int)rmt->scroll_remainder;
+	rmt->scroll_remainder -= clicks;
+
+	button = clicks < 0 ? MB_SCROLLUP : MB_SCROLLDOWN;
+	for (clicks = abs(clicks); clicks > 0; clicks--) {
+		enqueue_click(rmt, button, PR_PRESS);
+		enqueue_click(rmt, button, PR_RELEASE);
+	}
+}
+
+static void enqueue_clickevent(struct remote* rmt, mousebutton_t button, pressrel_t pr)
+{
+	unsigned int i, count = 1;
 
 	if (button == MB_SCROLLUP || button == MB_SCROLLDOWN) {
+		/* One SCROLL per wheel click instead of scrollmult clicks */
+		if (rmt->msgchan.features & PROT_CAP_SCROLL) {
+			if (pr == PR_PRESS)
+				enqueue_scroll(rmt, 0.0, button == MB_SCROLLUP ? -1.0 : 1.0);
+			return;
+		}
+
 		count = abs(rmt->scrollmult);
 		if (rmt->scrollmult < 0)
 			button = (button == MB_SCROLLUP) ? MB_SCROLLDOWN : MB_SCROLLUP;
 	}
 
-	for (i = 0; i < count; i++) {
+	for (i = 0; i < count; i++)
+		enqueue_click(rmt, button, pr);
+}
+
+void send_clickevent(struct remote* rmt, mousebutton_t button, pressrel_t pr)
+{
+	struct message* msg;
+	struct group_member* m;
+	struct group* grp = focused_group;
+
+	if (!rmt)
+		return;
+
+	if (!group_input(rmt)) {
+		enqueue_clickevent(rmt, button, pr);
+	} else if (button == MB_SCROLLUP || button == MB_SCROLLDOWN) {
+		/* Scroll multipliers are per-remote, so these can't be shared */
+		for (m = grp->members; m && focused_group == grp; m = m->next) {
+			if (group_member_ready(grp, m))
+				enqueue_clickevent(m->nr.node->remote, button, pr);
+		}
+	} else {
 		msg = new_message(MT_CLICKEVENT);
 
 		MB(msg, clickevent).button = button;
 		MB(msg, clickevent).pressrel = pr;
 
-		enqueue_message(rmt, msg);
+		send_group_input(msg);
 	}
 }
 
-void send_setbrightness(struct remote* rmt, float f)
+void send_scroll(struct remote* rmt, float dx, float dy)
 {
-	struct message* msg;
+	struct group_member* m;
+	struct group* grp = focused_group;
 
 	if (!rmt)
 		return;
 
-	msg = new_message(MT_SETBRIGHTNESS);
-
-	MB(msg, setbrightness).brightness = f;
+	if (!group_input(rmt)) {
+		enqueue_scroll(rmt, dx, dy);
+		return;
+	}
 
-	enqueue_message(rmt, msg);
+	/* As with scroll clicks, per-remote multipliers mean no sharing */
+	for (m = grp->members; m && focused_group == grp; m = m->next) {
+		if (group_member_ready(grp, m))
+			enqueue_scroll(m->nr.node->remote, dx, dy);
+	}
 }
 
-void send_setclipboard(struct remote* rmt, char* text)
+void send_setbrightness(struct remote* rmt, float f)
 {
 	struct message* msg;
 
 	if (!rmt)
 		return;
 
-	msg = new_message(MT_SETCLIPBOARD);
+	msg = new_message(MT_SETBRIGHTNESS);
 
-	MB(msg, setclipboard).text = text;
+	MB(msg, setbrightness).brightness = f;
 
 	enqueue_message(rmt, msg);
 }
 
-void send_setloglevel(struct remote* rmt, unsigned int level)
+/* Send clipboard contents to a remote, consuming the caller's reference. */
+void send_setclipboard(struct remote* rmt, struct clipbuf* text)
 {
 	struct message* msg;
 
-	if (!rmt)
+	if (!rmt) {
+		clipbuf_put(text);
 		return;
+	}
 
-	msg = new_message(MT_SETLOGLEVEL);
+	msg = new_message(MT_SETCLIPBOARD);
 
-	MB(msg, setloglevel).loglevel = level;
+	msg->clip = text;
+	MB(msg, setclipboard).text = text->text;
 
 	enqueue_message(rmt, msg);
 }
@@ -458,7 +644,8 @@ static void rmt_mc_read_cb(struct msgchan* mc, struct message* msg, void* arg)
 {
 	struct remote* rmt = arg;
 
-	if (msg->body.type != MT_MOUSEPOS && msg->body.type != MT_LOGMSG)
+	if (msg->body.type != MT_MOUSEPOS && msg->body.type != MT_LOGMSG
+	    && msg->body.type != MT_EDGEEVENT)
 		debug2("received %s from %s\n", msgtype_name(msg->body.type),
 		       rmt->node.name);
 
@@ -532,6 +719,7 @@ static void setup_remote(struct remote* rmt)
 
 	mc_init(&rmt->msgchan, sockfds[0], sockfds[0], rmt_mc_read_cb,
 	        rmt_mc_err_cb, rmt);
+	rmt->msgchan.batch_limit = config->batch_size;
 
 	if (close(sockfds[1]))
 		perror("close");
@@ -542,6 +730,7 @@ static void setup_remote(struct remote* rmt)
 	MB(setupmsg, setup).loglevel = config->log.level;
 	MB(setupmsg, setup).params.params_val = flatten_kvmap(rmt->params,
 	                                                      &MB(setupmsg, setup).params.params_len);
+	setupmsg->caps = rmt->prot_caps;
 
 	enqueue_message(rmt, setupmsg);
 }
@@ -577,6 +766,18 @@ static struct node* find_node(const char* name)
 	return rmt ? &rmt->node : NULL;
 }
 
+static struct group* find_group(const char* name)
+{
+	struct group* grp;
+
+	for (grp = config->groups; grp; grp = grp->next) {
+		if (!strcmp(name, grp->name))
+			return grp;
+	}
+
+	return NULL;
+}
+
 static void resolve_noderef(struct noderef* n)
 {
 	char* name;
@@ -622,6 +823,24 @@ static int node_enabled(struct node* n)
 	return !r || r->enabled;
 }
 
+static void resolve_groups(void)
+{
+	struct group* grp;
+	struct group_member* m;
+
+	for (grp = config->groups; grp; grp = grp->next) {
+		if (find_group(grp->name) != grp)
+			initdie("Duplicate group name: '%s'\n", grp->name);
+
+		for (m = grp->members; m; m = m->next) {
+			resolve_noderef(&m->nr);
+			if (is_master(m->nr.node))
+				initdie("Group '%s': master can't be a group member\n",
+				        grp->name);
+		}
+	}
+}
+
 static void apply_topology(void)
 {
 	struct link* ln;
@@ -709,6 +928,149 @@ static void check_remotes(void)
 }
 
 
+/*
+ * Send fetched clipboard contents to a remote, unless it's gone away since or
+ * already has them.
+ */
+static void send_clipboard_cb(struct clipbuf* text, void* arg)
+{
+	struct remote* rmt = arg;
+	uint64_t hash;
+
+	if (rmt->state != CS_CONNECTED) {
+		clipbuf_put(text);
+		return;
+	}
+
+	hash = clipbuf_hash(text);
+	if (hash == rmt->cliphash) {
+		debug("%s clipboard already up to date\n", rmt->node.name);
+		clipbuf_put(text);
+		return;
+	}
+
+	rmt->cliphash = hash;
+	send_setclipboard(rmt, text);
+}
+
+/* Send clipboard contents a remote has asked for, unconditionally. */
+static void supply_clipboard_cb(struct clipbuf* text, void* arg)
+{
+	struct remote* rmt = arg;
+
+	if (rmt->state != CS_CONNECTED) {
+		clipbuf_put(text);
+		return;
+	}
+
+	rmt->cliphash = clipbuf_hash(text);
+	send_setclipboard(rmt, text);
+}
+
+/*
+ * Bring a remote's clipboard up to date with the current contents, which
+ * the caller passes as 'text' (along with its reference to them) if it has
+ * them on hand, NULL otherwise.  If lazy transfers are enabled and
+ * the remote supports them, it's just told what's available, and can ask
+ * for the contents if and when something there pastes them.
+ */
+static void update_remote_clipboard(struct remote* rmt, struct clipbuf* text)
+{
+	struct message* msg;
+
+	if (!rmt || rmt->state != CS_CONNECTED) {
+		if (text)
+			clipbuf_put(text);
+		return;
+	}
+
+	if (!config->lazy_clipboard || !(rmt->msgchan.features & PROT_CAP_CLIPLAZY)) {
+		if (text)
+			send_clipboard_cb(text, rmt);
+		else
+			get_clipboard_text(send_clipboard_cb, rmt);
+		return;
+	}
+
+	if (text)
+		clipbuf_put(text);
+
+	if (rmt->cliphash == lazyclip.hash)
+		return;
+
+	msg = new_message(MT_CLIPOFFER);
+	MB(msg, clipoffer).hash = lazyclip.hash;
+	enqueue_message(rmt, msg);
+	rmt->cliphash = lazyclip.hash;
+}
+
+/* Note freshly-fetched master clipboard contents as current and pass them on. */
+static void master_clipboard_cb(struct clipbuf* text, void* arg)
+{
+	lazyclip.source = NULL;
+	lazyclip.hash = clipbuf_hash(text);
+	update_remote_clipboard(arg, text);
+}
+
+/* set_clipboard_lazy() callback: get the contents from their source. */
+static void fetch_lazy_clipboard(void* arg)
+{
+	struct clipbuf* empty;
+
+	if (lazyclip.source) {
+		enqueue_message(lazyclip.source, new_message(MT_GETCLIPBOARD));
+	} else {
+		empty = new_clipbuf(xstrdup(""));
+		set_clipboard_text(empty);
+		clipbuf_put(empty);
+	}
+}
+
+/*
+ * Make the master's clipboard stand in for a remote's, fetching the contents
+ * only if something asks for them.
+ */
+static void claim_lazy_clipboard(struct remote* rmt)
+{
+	lazyclip.source = rmt;
+	lazyclip.hash = rmt->cliphash;
+
+	if (set_clipboard_lazy(fetch_lazy_clipboard, NULL))
+		enqueue_message(rmt, new_message(MT_GETCLIPBOARD));
+}
+
+/*
+ * Compare the master's clipboard contents against the hash a remote reported
+ * for its own.  If they differ, fetch the remote's (or with lazy transfers,
+ * claim them); otherwise pass ours straight along to the focused remote (as
+ * if we'd just received the same thing from the reporting remote).
+ */
+static void check_cliphash_cb(struct clipbuf* text, void* arg)
+{
+	struct remote* rmt = arg;
+
+	if (rmt->state != CS_CONNECTED) {
+		clipbuf_put(text);
+		return;
+	}
+
+	if (clipbuf_hash(text) == rmt->cliphash) {
+		lazyclip.source = NULL;
+		lazyclip.hash = rmt->cliphash;
+		update_remote_clipboard(focused_node->remote, text);
+		return;
+	}
+
+	clipbuf_put(text);
+
+	if (config->lazy_clipboard) {
+		claim_lazy_clipboard(rmt);
+		update_remote_clipboard(focused_node->remote, NULL);
+	} else {
+		enqueue_message(rmt, new_message(MT_GETCLIPBOARD));
+	}
+}
+
 static void transfer_clipboard(struct node* from, struct node* to)
 {
 	if (is_master(from) && is_master(to)) {
@@ -717,9 +1079,13 @@ static void transfer_clipboard(struct node* from, struct node* to)
 	}
 
 	if (is_remote(from))
-		enqueue_message(from->remote, new_message(MT_GETCLIPBOARD));
+		enqueue_message(from->remote,
+		                new_message((from->remote->msgchan.features & PROT_CAP_CLIPHASH)
+		                            ? MT_GETCLIPHASH : MT_GETCLIPBOARD));
+	else if (is_remote(to) && clipboard_is_lazy())
+		update_remote_clipboard(to->remote, NULL);
 	else if (is_remote(to))
-		send_setclipboard(to->remote, get_clipboard_text());
+		get_clipboard_text(master_clipboard_cb, to->remote);
 }
 
 static void transfer_modifiers(struct node* from, struct node* to,
@@ -831,6 +1197,7 @@ static int reconnect_remote(struct remote* rmt)
 		if (!cancel_call(rmt->reconnect_timer))
 			warn("Failed to cancel reconnect_timer for remote %s\n",
 			     rmt->node.name);
+		rmt->reconnect_timer = NULL;
 	}
 
 	if (rmt->state == CS_SETTINGUP)
@@ -850,11 +1217,33 @@ static int reconnect_remote(struct remote* rmt)
 static void focus_master(void)
 {
 	ungrab_inputs(1);
+	focused_group = NULL;
 	last_focused_node = focused_node;
 	focused_node = &config->master;
 	indicate_switch(NULL, &config->master);
 }
 
+/*
+ * Stop broadcasting input to the focused group.  Input just continues going
+ * to the focused node, so this releases the given modifiers only on the
+ * group's other members.
+ */
+static void leave_group(const keycode_t* modkeys)
+{
+	int i;
+	struct group_member* m;
+	struct group* grp = focused_group;
+
+	focused_group = NULL;
+
+	for (m = grp->members; m; m = m->next) {
+		if (m->nr.node == focused_node || !group_member_active(m))
+			continue;
+		for (i = 0; modkeys[i] != ET_null; i++)
+			send_keyevent(m->nr.node->remote, modkeys[i], PR_RELEASE);
+	}
+}
+
 /*
  * Returns non-zero on a successful "real" switch, or zero if no actual switch
  * was performed (i.e. the switched-to node is the same as the current node,
@@ -865,6 +1254,10 @@ static int focus_node(struct node* n, keycode_t* modkeys, int via_hotkey)
 	struct node* to;
 	struct node* from;
 
+	/* Any explicit switch (even a null one) ends group input */
+	if (n && focused_group)
+		leave_group(modkeys);
+
 	if (!n) {
 		to = focused_node;
 	} else if (is_remote(n) && n->remote->state != CS_CONNECTED) {
@@ -910,6 +1303,53 @@ static int focus_neighbor(direction_t dir, keycode_t* modkeys, int via_hotkey)
 	return focus_node(focused_node->neighbors[dir], modkeys, via_hotkey);
 }
 
+/*
+ * Direct keyboard and mouse-button input to all connected members of a
+ * group (re-admitting any that have been dropped for falling behind).  Focus
+ * itself, and with it the mouse pointer and clipboard, goes to the first
+ * connected member.
+ */
+static void focus_group(struct group* grp, keycode_t* modkeys)
+{
+	int i;
+	struct group_member* m;
+	struct node* lead = NULL;
+
+	for (m = grp->members; m; m = m->next) {
+		m->dropped = 0;
+		if (!node_enabled(m->nr.node))
+			continue;
+		if (m->nr.node->remote->state != CS_CONNECTED) {
+			info("Remote %s not connected, attempting to reconnect...\n",
+			     m->nr.node->name);
+			reconnect_remote(m->nr.node->remote);
+		} else if (!lead) {
+			lead = m->nr.node;
+		}
+	}
+
+	if (!lead) {
+		info("No members of group '%s' connected\n", grp->name);
+		return;
+	}
+
+	if (focused_group == grp && focused_node == lead)
+		return;
+
+	focus_node(lead, modkeys, 1);
+
+	debug2("group focus: %s (via %s)\n", grp->name, lead->name);
+	focused_group = grp;
+
+	/* focus_node() took care of the lead's modifiers; do the rest. */
+	for (m = grp->members; m; m = m->next) {
+		if (m->nr.node == lead || !group_member_active(m))
+			continue;
+		for (i = 0; modkeys[i] != ET_null; i++)
+			send_keyevent(m->nr.node->remote, modkeys[i], PR_PRESS);
+	}
+}
+
 static void clear_ssh_config(struct ssh_config* c)
 {
 	xfree(c->remoteshell);
@@ -950,6 +1390,8 @@ static void shutdown_master(void)
 	struct remote* rmt;
 	struct hotkey* hk;
 	struct link* ln;
+	struct group* grp;
+	struct group_member* m;
 
 	while (config->remotes) {
 		rmt = config->remotes;
@@ -972,9 +1414,23 @@ static void shutdown_master(void)
 		xfree(ln);
 	}
 
+	while (config->groups) {
+		grp = config->groups;
+		config->groups = grp->next;
+		while (grp->members) {
+			m = grp->members;
+			grp->members = m->next;
+			xfree(m);
+		}
+		xfree(grp->name);
+		xfree(grp);
+	}
+
 	clear_ssh_config(&config->ssh_defaults);
 	xfree(config->master.name);
 
+	drain_msgpool();
+
 	platform_exit();
 
 	/* If we re-execed under a private agent, unload keys & kill it now. */
@@ -1009,11 +1465,13 @@ static int halt_reconnects(void)
 				disconnect_remote(rmt);
 
 			if (rmt->state == CS_FAILED) {
-				if (rmt->reconnect_timer)
+				if (rmt->reconnect_timer) {
 					cancel_call(rmt->reconnect_timer);
-				else
+					rmt->reconnect_timer = NULL;
+				} else {
 					bug("remote '%s' in CS_FAILED state, but reconnect_timer is unset\n",
 					    rmt->node.name);
+				}
 			}
 
 			rmt->state = CS_PERMFAILED;
@@ -1028,6 +1486,7 @@ static void action_cb(hotkey_context_t ctx, void* arg)
 {
 	int tmp;
 	struct remote* rmt;
+	struct message* msg;
 	struct action* a = arg;
 	keycode_t* modkeys = get_hotkey_modifiers(ctx);
 
@@ -1043,6 +1502,9 @@ static void action_cb(hotkey_context_t ctx, void* arg)
 		case FT_PREVIOUS:
 			focus_node(last_focused_node, modkeys, 1);
 			break;
+		case FT_GROUP:
+			focus_group(a->target.grp.group, modkeys);
+			break;
 		default:
 			errlog("bad focus-target type %u\n", a->target.type);
 			break;
@@ -1067,11 +1529,17 @@ static void action_cb(hotkey_context_t ctx, void* arg)
 
 	case AT_CLEARCLIPBOARD:
 		info("clearing clipboard on all connected nodes\n");
-		set_clipboard_text("");
+		msg = new_message(MT_SETCLIPBOARD);
+		msg->clip = new_clipbuf(xstrdup(""));
+		MB(msg, setclipboard).text = msg->clip->text;
+		set_clipboard_text(msg->clip);
+		lazyclip.source = NULL;
+		lazyclip.hash = clipbuf_hash(msg->clip);
 		for_each_remote (rmt) {
 			if (rmt->state == CS_CONNECTED)
-				send_setclipboard(rmt, xstrdup(""));
+				rmt->cliphash = lazyclip.hash;
 		}
+		broadcast_message(msg);
 		break;
 
 	case AT_STEP_LOGLEVEL:
@@ -1081,8 +1549,9 @@ static void action_cb(hotkey_context_t ctx, void* arg)
 		else if (tmp > LL_DEBUG2)
 			tmp = LL_DEBUG2;
 		set_loglevel(tmp);
-		for_each_remote (rmt)
-			send_setloglevel(rmt, tmp);
+		msg = new_message(MT_SETLOGLEVEL);
+		MB(msg, setloglevel).loglevel = tmp;
+		broadcast_message(msg);
 		break;
 
 	default:
@@ -1093,13 +1562,26 @@ static void action_cb(hotkey_context_t ctx, void* arg)
 	xfree(modkeys);
 }
 
+static void resolve_focus_target(struct focus_target* t)
+{
+	if (t->type == FT_NODE) {
+		resolve_noderef(&t->nr);
+	} else if (t->type == FT_GROUP) {
+		t->grp.group = find_group(t->grp.name);
+		if (!t->grp.group)
+			initdie("No such group: '%s'\n", t->grp.name);
+		xfree(t->grp.name);
+		t->grp.name = NULL;
+	}
+}
+
 static void bind_hotkeys(void)
 {
 	struct hotkey* k;
 
 	for (k = config->hotkeys; k; k = k->next) {
-		if (k->action.type == AT_FOCUS && k->action.target.type == FT_NODE)
-			resolve_noderef(&k->action.target.nr);
+		if (k->action.type == AT_FOCUS)
+			resolve_focus_target(&k->action.target);
 		if (bind_hotkey(k->key_string, action_cb, &k->action))
 			exit(1);
 	}
@@ -1130,9 +1612,11 @@ static uint64_t get_edgehist_entry(const struct edge_state* es, int rel_idx)
  * Send the screen-relative reposition to make switch-by-mouse look more
  * "natural" -- so the mouse pointer slides semi-continuously from one node's
  * screen to a corresponding position on the next's, rather than jumping to
- * wherever it last was on the destination node.
+ * wherever it last was on the destination node.  'edgepos' is the pointer's
+ * position along the edge it departed from, as a fraction of that edge's
+ * length.
  */
-static void edgeswitch_reposition(direction_t dir, float src_x, float src_y)
+static void edgeswitch_reposition(direction_t dir, float edgepos)
 {
 	struct message* msg;
 	struct xypoint pt;
@@ -1141,21 +1625,21 @@ static void edgeswitch_reposition(direction_t dir, float src_x, float src_y)
 	switch (dir) {
 	case LEFT:
 		pt.x = screendim->x.max;
-		pt.y = lrintf(src_y * (float)screendim->y.max);
+		pt.y = lrintf(edgepos * (float)screendim->y.max);
 		break;
 
 	case RIGHT:
 		pt.x = screendim->x.min;
-		pt.y = lrintf(src_y * (float)screendim->y.max);
+		pt.y = lrintf(edgepos * (float)screendim->y.max);
 		break;
 
 	case UP:
-		pt.x = lrintf(src_x * (float)screendim->x.max);
+		pt.x = lrintf(edgepos * (float)screendim->x.max);
 		pt.y = screendim->y.max;
 		break;
 
 	case DOWN:
-		pt.x = lrintf(src_x * (float)screendim->x.max);
+		pt.x = lrintf(edgepos * (float)screendim->x.max);
 		pt.y = screendim->y.min;
 		break;
 
@@ -1170,11 +1654,12 @@ static void edgeswitch_reposition(direction_t dir, float src_x, float src_y)
 		enqueue_message(focused_node->remote, msg);
 	} else {
 		set_mousepos(pt);
+		flush_input_events();
 	}
 }
 
 static int trigger_edgeevent(struct edge_state* ehist, direction_t dir, edgeevent_t evtype,
-                             float src_xpos, float src_ypos)
+                             float edgepos)
 {
 	int status, start_idx;
 	keycode_t* modkeys;
@@ -1200,7 +1685,7 @@ static int trigger_edgeevent(struct edge_state* ehist, direction_t dir, edgeeven
 		if (duration <= config->mouseswitch.window) {
 			modkeys = get_current_modifiers();
 			if (focus_neighbor(dir, modkeys, 0))
-				edgeswitch_reposition(dir, src_xpos, src_ypos);
+				edgeswitch_reposition(dir, edgepos);
 			xfree(modkeys);
 		}
 	}
@@ -1208,20 +1693,17 @@ static int trigger_edgeevent(struct edge_state* ehist, direction_t dir, edgeeven
 	return 0;
 }
 
-static dirmask_t point_edgemask(struct xypoint pt, const struct rectangle* screen)
+/* Record an edge event on the given node (possibly triggering a switch). */
+static void node_edgeevent(struct node* node, direction_t dir, edgeevent_t evtype,
+                           float edgepos)
 {
-	dirmask_t mask = 0;
-
-	if (pt.x == screen->x.min)
-		mask |= LEFTMASK;
-	if (pt.x == screen->x.max)
-		mask |= RIGHTMASK;
-	if (pt.y == screen->y.min)
-		mask |= UPMASK;
-	if (pt.y == screen->y.max)
-		mask |= DOWNMASK;
+	if (evtype == EE_ARRIVE)
+		node->edgemask |= 1U << dir;
+	else
+		node->edgemask &= ~(1U << dir);
 
-	return mask;
+	if (trigger_edgeevent(&node->edgehist[dir], dir, evtype, edgepos))
+		warn("out-of-sync edge event on %s ignored\n", node->name);
 }
 
 static void check_edgeevents(struct node* node, struct xypoint pt)
@@ -1229,25 +1711,19 @@ static void check_edgeevents(struct node* node, struct xypoint pt)
 	direction_t dir;
 	dirmask_t newmask, oldmask, dirmask;
 	edgeevent_t edgeevtype;
-	float xpos, ypos;
 
 	newmask = point_edgemask(pt, &node->dimensions);
 	oldmask = node->edgemask;
 
-	node->edgemask = newmask;
-
 	if (newmask == oldmask)
 		return;
 
-	xpos = (float)pt.x / (float)node->dimensions.x.max;
-	ypos = (float)pt.y / (float)node->dimensions.y.max;
-
 	for_each_direction (dir) {
 		dirmask = 1U << dir;
 		if ((oldmask & dirmask) != (newmask & dirmask)) {
 			edgeevtype = (newmask & dirmask) ? EE_ARRIVE : EE_DEPART;
-			if (trigger_edgeevent(&node->edgehist[dir], dir, edgeevtype, xpos, ypos))
-				warn("out-of-sync edge event on %s ignored\n", node->name);
+			node_edgeevent(node, dir, edgeevtype,
+			               edge_position(dir, pt, &node->dimensions));
 		}
 	}
 }
@@ -1261,6 +1737,7 @@ static void handle_message(struct remote* rmt, const struct message* msg)
 {
 	int loglen;
 	char* logmsg;
+	char* features;
 	struct rectangle screendim;
 
 	switch (msg->body.type) {
@@ -1277,6 +1754,11 @@ static void handle_message(struct remote* rmt, const struct message* msg)
 		      screendim.x.max - screendim.x.min + 1,
 		      screendim.y.max - screendim.y.min + 1);
 		rmt->node.dimensions = screendim;
+		rmt->cliphash = 0;
+		rmt->msgchan.features = msg->caps & rmt->prot_caps;
+		features = prot_caps_str(rmt->msgchan.features);
+		vinfo("%s protocol features: %s\n", rmt->node.name, features);
+		xfree(features);
 		if (config->focus_hint.type == FH_DIM_INACTIVE)
 			transition_brightness(&rmt->node, 1.0, config->focus_hint.brightness,
 			                      config->focus_hint.duration,
@@ -1284,9 +1766,36 @@ static void handle_message(struct remote* rmt, const struct message* msg)
 		break;
 
 	case MT_SETCLIPBOARD:
-		set_clipboard_text(MB(msg, setclipboard).text);
-		if (focused_node->remote)
-			send_setclipboard(focused_node->remote, get_clipboard_text());
+		rmt->cliphash = clipbuf_hash(msg->clip);
+		set_clipboard_text(msg->clip);
+		lazyclip.source = NULL;
+		lazyclip.hash = rmt->cliphash;
+		update_remote_clipboard(focused_node->remote, NULL);
+		break;
+
+	case MT_GETCLIPBOARD:
+		if (!(rmt->msgchan.features & PROT_CAP_CLIPLAZY)) {
+			fail_remote(rmt, "unexpected GETCLIPBOARD message");
+			break;
+		}
+		if (rmt == lazyclip.source && clipboard_is_lazy()) {
+			/* Each is waiting on the other; break the cycle. */
+			warn("%s requested its own clipboard contents\n", rmt->node.name);
+			supply_clipboard_cb(new_clipbuf(xstrdup("")), rmt);
+			break;
+		}
+		get_clipboard_text(supply_clipboard_cb, rmt);
+		break;
+
+	case MT_CLIPHASH:
+		rmt->cliphash = MB(msg, cliphash).hash;
+		if (!clipboard_is_lazy()) {
+			get_clipboard_text(check_cliphash_cb, rmt);
+			break;
+		}
+		if (rmt->cliphash != lazyclip.hash)
+			claim_lazy_clipboard(rmt);
+		update_remote_clipboard(focused_node->remote, NULL);
 		break;
 
 	case MT_LOGMSG:
@@ -1304,6 +1813,17 @@ static void handle_message(struct remote* rmt, const struct message* msg)
 		check_edgeevents(&rmt->node, MB(msg, mousepos).pt);
 		break;
 
+	case MT_EDGEEVENT:
+		if (MB(msg, edgeevent).dir >= NUM_DIRECTIONS
+		    || (MB(msg, edgeevent).evtype != EE_ARRIVE
+		        && MB(msg, edgeevent).evtype != EE_DEPART)) {
+			fail_remote(rmt, "invalid EDGEEVENT message");
+			break;
+		}
+		node_edgeevent(&rmt->node, MB(msg, edgeevent).dir,
+		               MB(msg, edgeevent).evtype, MB(msg, edgeevent).pos);
+		break;
+
 	default:
 		fail_remote(rmt, "unexpected message type");
 		break;
@@ -1619,6 +2139,7 @@ int main(int argc, char** argv)
 
 	apply_topology();
 	check_remotes();
+	resolve_groups();
 	bind_hotkeys();
 
 	focused_node = &config->master;
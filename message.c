@@ -29,6 +29,12 @@ static int xdr_tracksize(xdrrec_ptr_t handle, xdrrec_ptr_t buf, int len)
 	return len;
 }
 
+/* Whether messages of the given type carry a capability-bitmask trailer */
+static inline int has_caps_trailer(msgtype_t type)
+{
+	return type == MT_SETUP || type == MT_READY;
+}
+
 /*
  * HACK: the XDR API doesn't seem to have any direct way to answer the
  * question "how many bytes will this thing take up after encoding?" (e.g. for
@@ -50,7 +56,9 @@ static size_t xdr_msgbody_len(const struct message* msg)
 	xdrrec_create(&xdrs, 0, 0, (char*)&pos, NULL, xdr_tracksize);
 	xdrs.x_op = XDR_ENCODE;
 
-	if (!xdr_msgbody(&xdrs, (struct msgbody*)&msg->body)) {
+	if (!xdr_msgbody(&xdrs, (struct msgbody*)&msg->body)
+	    || (has_caps_trailer(msg->body.type)
+	        && !xdr_uint32_t(&xdrs, (uint32_t*)&msg->caps))) {
 		fprintf(stderr, "xdr_msgbody() failed in xdr_msgbody_len()\n");
 		abort();
 	}
@@ -80,107 +88,590 @@ static size_t xdr_msgbody_len(const struct message* msg)
  * Why not just have it be straight XDR?  Because the XDR API does not, as far
  * as I can tell, offer any interface that would integrate nicely with an
  * async-IO/O_NOBLOCK/select(2)-based event-loop IO scheme.
+ *
+ * SETUP and READY messages additionally carry a trailer after the XDR body
+ * (but within the length given by the descriptor): a u32 bitmask of the
+ * sender's supported PROT_CAP_* capabilities.  Older versions ignore any
+ * bytes past the end of the XDR body, and a message lacking the trailer is
+ * treated as advertising no capabilities, so this remains compatible in both
+ * directions.
+ *
+ * If both ends support PROT_CAP_FIXEDMSG, the small fixed-size input messages
+ * (see fixedmsg_sizes[] below) may instead be sent as fixed-layout frames: a
+ * u32 header with FIXEDMSG_FLAG set and the message type in the remaining
+ * bits, followed by the message's fields as u32s in network order.  Since the
+ * payload size is implied by the type, no length descriptor is needed, and
+ * these can be encoded and decoded directly without any XDR machinery.
+ *
+ * If both ends support PROT_CAP_BATCH, several frames can be sent wrapped in
+ * a batch frame: a u32 header with BATCHMSG_FLAG set and the total length of
+ * the enclosed frames in the remaining bits, followed by those frames.  The
+ * receiver doesn't process any of them until the whole batch has arrived, so
+ * e.g. the events making up a key chord are always applied together.
+ */
+
+/* Payload sizes of message types that can be sent as fixed-layout frames */
+static const size_t fixedmsg_sizes[] = {
+	[MT_MOVEREL] = 2 * sizeof(uint32_t),
+	[MT_MOVEABS] = 2 * sizeof(uint32_t),
+	[MT_MOUSEPOS] = 2 * sizeof(uint32_t),
+	[MT_CLICKEVENT] = 2 * sizeof(uint32_t),
+	[MT_KEYEVENT] = 2 * sizeof(uint32_t),
+};
+
+/*
+ * Return the payload size of a fixed-layout frame of the given type, or zero
+ * if the type can't be sent as one.
+ */
+static size_t fixedmsg_payload_size(uint32_t type)
+{
+	return type < ARR_LEN(fixedmsg_sizes) ? fixedmsg_sizes[type] : 0;
+}
+
+static inline void put_u32(char** p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(*p, &v, sizeof(v));
+	*p += sizeof(v);
+}
+
+static inline uint32_t get_u32(const char** p)
+{
+	uint32_t v;
+	memcpy(&v, *p, sizeof(v));
+	*p += sizeof(v);
+	return ntohl(v);
+}
+
+/*
+ * Encode the given message as a fixed-layout frame (header included) into
+ * buf, which must have room for at least FIXEDMSG_MAXSIZE bytes.  Returns the
+ * number of bytes written, or zero if the message's type can't be sent as a
+ * fixed-layout frame.
+ */
+size_t pack_fixed_message(const struct message* msg, void* buf)
+{
+	char* p = buf;
+	size_t plsize = fixedmsg_payload_size(msg->body.type);
+
+	if (!plsize)
+		return 0;
+
+	put_u32(&p, FIXEDMSG_FLAG | msg->body.type);
+
+	switch (msg->body.type) {
+	case MT_MOVEREL:
+		put_u32(&p, MB(msg, moverel).dx);
+		put_u32(&p, MB(msg, moverel).dy);
+		break;
+
+	case MT_MOVEABS:
+		put_u32(&p, MB(msg, moveabs).pt.x);
+		put_u32(&p, MB(msg, moveabs).pt.y);
+		break;
+
+	case MT_MOUSEPOS:
+		put_u32(&p, MB(msg, mousepos).pt.x);
+		put_u32(&p, MB(msg, mousepos).pt.y);
+		break;
+
+	case MT_CLICKEVENT:
+		put_u32(&p, MB(msg, clickevent).button);
+		put_u32(&p, MB(msg, clickevent).pressrel);
+		break;
+
+	case MT_KEYEVENT:
+		put_u32(&p, MB(msg, keyevent).keycode);
+		put_u32(&p, MB(msg, keyevent).pressrel);
+		break;
+
+	default:
+		abort();
+	}
+
+	assert(p - (char*)buf == MSGHDR_SIZE + plsize);
+
+	return MSGHDR_SIZE + plsize;
+}
+
+/* Inverse of pack_fixed_message() (minus the header, which is already consumed). */
+static void unpack_fixed_message(msgtype_t type, const void* buf, struct message* msg)
+{
+	const char* p = buf;
+
+	msg->body.type = type;
+	msg->from_xdr = 0;
+	msg->caps = 0;
+
+	switch (type) {
+	case MT_MOVEREL:
+		MB(msg, moverel).dx = get_u32(&p);
+		MB(msg, moverel).dy = get_u32(&p);
+		break;
+
+	case MT_MOVEABS:
+		MB(msg, moveabs).pt.x = get_u32(&p);
+		MB(msg, moveabs).pt.y = get_u32(&p);
+		break;
+
+	case MT_MOUSEPOS:
+		MB(msg, mousepos).pt.x = get_u32(&p);
+		MB(msg, mousepos).pt.y = get_u32(&p);
+		break;
+
+	case MT_CLICKEVENT:
+		MB(msg, clickevent).button = get_u32(&p);
+		MB(msg, clickevent).pressrel = get_u32(&p);
+		break;
+
+	case MT_KEYEVENT:
+		MB(msg, keyevent).keycode = get_u32(&p);
+		MB(msg, keyevent).pressrel = get_u32(&p);
+		break;
+
+	default:
+		abort();
+	}
+}
+
+/*
+ * Initial allocation size of a sendbuf; if one grows beyond this to
+ * accommodate an unusually large message, its memory is released once it's
+ * been drained.
+ */
+#define SENDBUF_MINSIZE 4096
+
+/*
+ * Ensure there's room for at least 'len' more bytes at the end of the given
+ * sendbuf, returning a pointer to that space.
  */
+static char* sendbuf_reserve(struct sendbuf* sb, size_t len)
+{
+	unsigned int i;
+	size_t newsize;
+
+	if (sb->end + len <= sb->size)
+		return sb->buf + sb->end;
+
+	if (sb->start) {
+		memmove(sb->buf, sb->buf + sb->start, sb->end - sb->start);
+		for (i = 0; i < sb->msgs.num; i++)
+			sb->msgs.ends[sb->msgs.first + i] -= sb->start;
+		if (sb->moverel.start != SENDBUF_NONE && sb->moverel.start >= sb->start) {
+			sb->moverel.start -= sb->start;
+			sb->moverel.dx -= sb->start;
+		} else {
+			sb->moverel.start = SENDBUF_NONE;
+		}
+		sb->end -= sb->start;
+		sb->start = 0;
+	}
+
+	if (sb->end + len > sb->size) {
+		newsize = sb->size ? sb->size : SENDBUF_MINSIZE;
+		while (newsize < sb->end + len)
+			newsize *= 2;
+		sb->buf = xrealloc(sb->buf, newsize);
+		sb->size = newsize;
+	}
+
+	return sb->buf + sb->end;
+}
 
-/* Flatten a message struct into a wire-protocol format byte array */
-void unparse_message(const struct message* msg, struct partsend* ps)
+/* Record the end offset of a newly-queued (non-MOVEREL) message. */
+static void sendbuf_push_msgend(struct sendbuf* sb, size_t end)
+{
+	if (sb->msgs.first + sb->msgs.num == sb->msgs.size) {
+		if (sb->msgs.first) {
+			memmove(sb->msgs.ends, sb->msgs.ends + sb->msgs.first,
+			        sb->msgs.num * sizeof(*sb->msgs.ends));
+			sb->msgs.first = 0;
+		} else {
+			sb->msgs.size = sb->msgs.size ? sb->msgs.size * 2 : 16;
+			sb->msgs.ends = xrealloc(sb->msgs.ends, sb->msgs.size
+			                         * sizeof(*sb->msgs.ends));
+		}
+	}
+
+	sb->msgs.ends[sb->msgs.first + sb->msgs.num] = end;
+	sb->msgs.num += 1;
+}
+
+/*
+ * Record a newly-appended message of 'len' bytes at the end of a sendbuf.
+ * 'dxoff' is the offset (within the message) of the dx field if the message
+ * is a MOVEREL, and ignored otherwise.
+ */
+static void sendbuf_commit(struct sendbuf* sb, const struct message* msg,
+                           size_t len, size_t dxoff)
+{
+	if (msg->body.type == MT_MOVEREL) {
+		/*
+		 * Not counted as part of the backlog, since subsequent
+		 * motion can be merged into it; see coalesce_moverel().
+		 */
+		sb->moverel.start = sb->end;
+		sb->moverel.dx = sb->end + dxoff;
+		sb->end += len;
+		return;
+	}
+
+	sb->moverel.start = SENDBUF_NONE;
+	sb->end += len;
+	sendbuf_push_msgend(sb, sb->end);
+}
+
+static inline int32_t clamp_i32(int64_t v)
+{
+	return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : v;
+}
+
+/*
+ * If the most recently queued message in the given sendbuf is a MOVEREL none
+ * of which has been sent yet, add the given MOVEREL's deltas into it in place
+ * and return 1; otherwise return 0.  Since nothing else can have been queued
+ * between the two, merging them doesn't reorder anything with respect to
+ * other (e.g. click or key) events.
+ */
+int coalesce_moverel(struct sendbuf* sb, const struct message* msg)
+{
+	char* p;
+	const char* cp;
+	int64_t dx, dy;
+
+	if (msg->body.type != MT_MOVEREL || sb->moverel.start == SENDBUF_NONE
+	    || sb->moverel.start < sb->start)
+		return 0;
+
+	cp = sb->buf + sb->moverel.dx;
+	dx = (int32_t)get_u32(&cp) + (int64_t)MB(msg, moverel).dx;
+	dy = (int32_t)get_u32(&cp) + (int64_t)MB(msg, moverel).dy;
+
+	p = sb->buf + sb->moverel.dx;
+	put_u32(&p, clamp_i32(dx));
+	put_u32(&p, clamp_i32(dy));
+
+	return 1;
+}
+
+/*
+ * Flatten a message struct into wire-protocol format, appending it to the
+ * given sendbuf.  A fixed-layout frame is used if the given feature set
+ * (PROT_CAP_* flags negotiated with the recipient) allows it.
+ */
+void unparse_message(const struct message* msg, struct sendbuf* sb,
+                     uint32_t features)
 {
 	XDR xdrs;
 	unsigned int pos;
-	size_t xdrlen = xdr_msgbody_len(msg);
+	size_t xdrlen, len;
+	char* p;
+
+	if (features & PROT_CAP_FIXEDMSG) {
+		p = sendbuf_reserve(sb, FIXEDMSG_MAXSIZE);
+		len = pack_fixed_message(msg, p);
+		if (len) {
+			sendbuf_commit(sb, msg, len, MSGHDR_SIZE);
+			return;
+		}
+	}
 
-	ps->len = xdrlen + MSGHDR_SIZE;
-	ps->buf = xmalloc(ps->len);
-	*(uint32_t*)ps->buf = htonl(xdrlen);
+	xdrlen = xdr_msgbody_len(msg);
+	p = sendbuf_reserve(sb, xdrlen + MSGHDR_SIZE);
 
-	xdrmem_create(&xdrs, ps->buf + MSGHDR_SIZE, xdrlen, XDR_ENCODE);
+	xdrmem_create(&xdrs, p + MSGHDR_SIZE, xdrlen, XDR_ENCODE);
 
-	if (!xdr_msgbody(&xdrs, (struct msgbody*)&msg->body)) {
+	if (!xdr_msgbody(&xdrs, (struct msgbody*)&msg->body)
+	    || (has_caps_trailer(msg->body.type)
+	        && !xdr_uint32_t(&xdrs, (uint32_t*)&msg->caps))) {
 		fprintf(stderr, "xdr_msgbody() failed in unparse_message()\n");
 		abort();
 	}
 
+	/* This is probably smaller than xdrlen; see comment on xdr_msgbody_len(). */
 	pos = xdr_getpos(&xdrs);
+	assert(pos <= xdrlen);
+	*(uint32_t*)(void*)p = htonl(pos);
+
+	xdr_destroy(&xdrs);
+
+	/* The dx field follows the header and the XDR union discriminant */
+	sendbuf_commit(sb, msg, pos + MSGHDR_SIZE, MSGHDR_SIZE + sizeof(uint32_t));
+}
+
+/* Wrap a message (taking ownership of it) for sending to several msgchans. */
+struct sharedmsg* new_sharedmsg(struct message* msg)
+{
+	struct sharedmsg* sm = xcalloc(sizeof(*sm));
+
+	assert(msg->body.type != MT_MOVEREL);
+	assert(!has_caps_trailer(msg->body.type));
+
+	sm->msg = msg;
+
+	return sm;
+}
+
+/*
+ * Append a shared message to a sendbuf, in the form appropriate to the given
+ * feature set, serializing it in that form if not yet done.
+ */
+void append_sharedmsg(struct sharedmsg* sm, struct sendbuf* sb, uint32_t features)
+{
+	struct sendbuf tmp = { .moverel.start = SENDBUF_NONE, };
+	int fixed = (features & PROT_CAP_FIXEDMSG)
+		&& fixedmsg_payload_size(sm->msg->body.type);
+
+	if (!sm->frames[fixed].buf) {
+		unparse_message(sm->msg, &tmp, fixed ? PROT_CAP_FIXEDMSG : 0);
+		sm->frames[fixed].buf = tmp.buf;
+		sm->frames[fixed].len = tmp.end;
+		xfree(tmp.msgs.ends);
+	}
 
-	/* This is probably always the case.  See comment on xdr_msgbody_len(). */
-	if (pos != xdrlen) {
-		assert(pos < xdrlen);
-		ps->len = pos + MSGHDR_SIZE;
-		ps->buf = xrealloc(ps->buf, ps->len);
-		*(uint32_t*)ps->buf = htonl(pos);
+	memcpy(sendbuf_reserve(sb, sm->frames[fixed].len), sm->frames[fixed].buf,
+	       sm->frames[fixed].len);
+	sendbuf_commit(sb, sm->msg, sm->frames[fixed].len, 0);
+}
+
+void free_sharedmsg(struct sharedmsg* sm)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARR_LEN(sm->frames); i++) {
+		if (sm->frames[i].buf)
+			explicit_bzero(sm->frames[i].buf, sm->frames[i].len);
+		xfree(sm->frames[i].buf);
 	}
+	free_message(sm->msg);
+	xfree(sm);
+}
 
-	xdr_destroy(&xdrs);
+/*
+ * Release the memory held by a sendbuf, discarding any data it contains.
+ * Outgoing data may include sensitive things like clipboard contents and
+ * keystrokes, so it's wiped first.
+ */
+static void free_sendbuf_mem(struct sendbuf* sb)
+{
+	if (sb->buf)
+		explicit_bzero(sb->buf, sb->size);
+	xfree(sb->buf);
+	sb->buf = NULL;
+	sb->size = 0;
+}
+
+/* Discard all data in the given sendbuf and release its memory. */
+void clear_sendbuf(struct sendbuf* sb)
+{
+	free_sendbuf_mem(sb);
+	sb->start = sb->end = 0;
+	sb->partial = 0;
+	sb->moverel.start = SENDBUF_NONE;
+
+	xfree(sb->msgs.ends);
+	memset(&sb->msgs, 0, sizeof(sb->msgs));
 }
 
 /*
- * Drain data in the given partsend buffer out via the given file descriptor.
- * Returns 1 if the buffer is successfully emptied, 0 if data remains and
- * further writes to the file descriptor would block, and negative on error.
+ * Move everything queued in 'src' (none of which may have been sent yet) to
+ * the end of 'dst', leaving 'src' empty.
  */
-int drain_msgbuf(int fd, struct partsend* ps)
+void sendbuf_move(struct sendbuf* dst, struct sendbuf* src)
+{
+	unsigned int i;
+	size_t base, len = src->end - src->start;
+
+	if (len) {
+		memcpy(sendbuf_reserve(dst, len), src->buf + src->start, len);
+		base = dst->end - src->start;
+		for (i = 0; i < src->msgs.num; i++)
+			sendbuf_push_msgend(dst, base + src->msgs.ends[src->msgs.first + i]);
+		dst->end += len;
+		dst->moverel.start = SENDBUF_NONE;
+	}
+
+	clear_sendbuf(src);
+}
+
+/*
+ * Write out data in the given sendbuf up to offset 'limit' via the given file
+ * descriptor.  Returns 1 if everything up to 'limit' was sent, 0 if not (and
+ * further writes to the file descriptor would block), and negative on error.
+ */
+static int drain_sendbuf_upto(int fd, struct sendbuf* sb, size_t limit)
 {
 	ssize_t status;
+	size_t prevstart = sb->start;
 
-	while (ps->bytes_sent < ps->len) {
-		status = write(fd, ps->buf + ps->bytes_sent,
-		               ps->len - ps->bytes_sent);
+	while (sb->start < limit) {
+		status = write(fd, sb->buf + sb->start, limit - sb->start);
 		if (status < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				return 0;
+				break;
 			else
 				return -errno;
 		}
-		ps->bytes_sent += status;
+		sb->start += status;
+	}
+
+	if (sb->start != prevstart)
+		sb->partial = 1;
+
+	while (sb->msgs.num && sb->msgs.ends[sb->msgs.first] <= sb->start) {
+		sb->partial = sb->msgs.ends[sb->msgs.first] != sb->start;
+		sb->msgs.first += 1;
+		sb->msgs.num -= 1;
 	}
 
-	xfree(ps->buf);
-	ps->buf = NULL;
-	ps->len = 0;
-	ps->bytes_sent = 0;
+	if (sb->start < limit)
+		return 0;
+	else if (sb->start < sb->end)
+		return 1;
+
+	sb->start = sb->end = 0;
+	sb->partial = 0;
+	sb->msgs.first = 0;
+	sb->moverel.start = SENDBUF_NONE;
+
+	if (sb->size > SENDBUF_MINSIZE)
+		free_sendbuf_mem(sb);
 
 	return 1;
 }
 
 /*
- * Try to read a message (or the remainder of a partially-received one) into
- * the given partrecv buffer from the given file descriptor.  Returns 1 if the
- * buffer has been filled with a complete message, 0 if the message is
- * incomplete and further reads on the file descriptor would block, and
- * negative on error.
+ * Drain data in the given sendbuf out via the given file descriptor.  Returns
+ * 1 if the buffer is successfully emptied, 0 if data remains and further
+ * writes to the file descriptor would block, and negative on error.
  */
-int fill_msgbuf(int fd, struct partrecv* pr)
+int drain_sendbuf(int fd, struct sendbuf* sb)
 {
-	ssize_t status, to_read;
-	uint32_t msgsize;
-	void* hdrbuf;
+	return drain_sendbuf_upto(fd, sb, sb->end);
+}
 
-	while (pr->bytes_recvd < MSGHDR_SIZE) {
-		status = read(fd, pr->hdrbuf + pr->bytes_recvd,
-		              MSGHDR_SIZE - pr->bytes_recvd);
-		if (status < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				return 0;
-			else
-				return -errno;
-		} else if (status == 0) {
-			return -EINVAL;
-		}
-		pr->bytes_recvd += status;
+/*
+ * If the first message in the given sendbuf has been partially sent, try to
+ * send the rest of it (so that data from elsewhere can be sent next without
+ * corrupting the stream).  Returns as for drain_sendbuf().
+ */
+int finish_sendbuf_msg(int fd, struct sendbuf* sb)
+{
+	if (!sb->partial)
+		return 1;
+
+	return drain_sendbuf_upto(fd, sb, sb->msgs.num ? sb->msgs.ends[sb->msgs.first]
+	                          : sb->end);
+}
+
+/*
+ * Reserve space for a batch-frame header at the end of the given sendbuf,
+ * which must be empty, returning its offset.  Subsequently queued messages
+ * form the contents of the batch until it's ended with sendbuf_end_batch();
+ * the sendbuf mustn't be drained in the meantime.
+ */
+size_t sendbuf_begin_batch(struct sendbuf* sb)
+{
+	assert(sendbuf_empty(sb));
+
+	sb->start = sb->end = 0;
+	sb->moverel.start = SENDBUF_NONE;
+	sendbuf_reserve(sb, MSGHDR_SIZE);
+	sb->end += MSGHDR_SIZE;
+
+	return 0;
+}
+
+/*
+ * Finish a batch started by sendbuf_begin_batch() (whose header is at offset
+ * 'hdr').  If 'wrap' is zero the header is dropped, leaving the batch's
+ * messages to be sent as ordinary individual frames.
+ */
+void sendbuf_end_batch(struct sendbuf* sb, size_t hdr, int wrap)
+{
+	char* p = sb->buf + hdr;
+
+	assert(hdr == sb->start);
+
+	if (!wrap) {
+		sb->start += MSGHDR_SIZE;
+		return;
+	}
+
+	put_u32(&p, BATCHMSG_FLAG | (sb->end - hdr - MSGHDR_SIZE));
+
+	/* The batch has to go out as a unit, so count it as one message */
+	if (sb->msgs.num) {
+		sb->msgs.ends[sb->msgs.first] = sb->end;
+		sb->msgs.num = 1;
+	}
+}
+
+/*
+ * Default (and initial) size of a recvbuf.  It will be enlarged if necessary
+ * to hold a single larger message, and released once that's been parsed.
+ */
+#define RECVBUF_SIZE (64 * 1024)
+
+/*
+ * Read whatever data is available (up to the space remaining) from the given
+ * file descriptor into the given recvbuf.  Returns positive if data was read,
+ * zero if there was none and further reads would block, and negative on
+ * error.
+ */
+int fill_recvbuf(int fd, struct recvbuf* rb)
+{
+	ssize_t status;
+
+	if (!rb->buf) {
+		rb->buf = xmalloc(RECVBUF_SIZE);
+		rb->size = RECVBUF_SIZE;
+		rb->start = rb->end = 0;
 	}
 
-	hdrbuf = pr->hdrbuf;
-	msgsize = ntohl(*(uint32_t*)hdrbuf);
+	/* parse_message() ensures there's always room for more */
+	assert(rb->end < rb->size);
+
+	status = read(fd, rb->buf + rb->end, rb->size - rb->end);
+	if (status < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		else
+			return -errno;
+	} else if (status == 0) {
+		return -EINVAL;
+	}
+
+	rb->end += status;
+
+	return 1;
+}
+
+/*
+ * Make sure the given recvbuf can hold 'len' bytes starting at the beginning
+ * of its first unparsed message, sliding that partial message down to the
+ * front of the buffer and/or enlarging the buffer as necessary.  Returns zero
+ * on success and negative on error.
+ */
+static int recvbuf_make_room(struct recvbuf* rb, size_t len)
+{
+	char* newbuf;
 
-	to_read = msgsize - (pr->bytes_recvd - MSGHDR_SIZE);
+	if (rb->start + len <= rb->size)
+		return 0;
 
-	if (!pr->plbuf) {
-		assert(pr->bytes_recvd == MSGHDR_SIZE);
+	if (rb->start) {
+		memmove(rb->buf, rb->buf + rb->start, rb->end - rb->start);
+		rb->end -= rb->start;
+		rb->start = 0;
+	}
+
+	if (len > rb->size) {
 		/*
-		 * NOTE: malloc() instead of xmalloc() here is intentional.
+		 * NOTE: realloc() instead of xrealloc() here is intentional.
 		 * This allocation size is taken directly from raw input from
 		 * the network, and if for some reason a remote starts sending
-		 * bogusly huge messages (large enough to make malloc fail) it
+		 * bogusly huge messages (large enough to make realloc fail) it
 		 * shouldn't be able to just trivially kill the master (in the
 		 * master, returning an error here will end up with the
 		 * sending remote getting failed, which is the appropriate
@@ -194,59 +685,153 @@ int fill_msgbuf(int fd, struct partrecv* pr)
 		 * really achieve that without breaking into the XDR black
 		 * box.
 		 */
-		pr->plbuf = malloc(msgsize);
-		if (!pr->plbuf)
+		newbuf = realloc(rb->buf, len);
+		if (!newbuf)
 			return -ENOMEM;
+		rb->buf = newbuf;
+		rb->size = len;
 	}
 
-	while (to_read > 0) {
-		status = read(fd, pr->plbuf + (pr->bytes_recvd - MSGHDR_SIZE), to_read);
-		if (status < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				return 0;
-			else
-				return -errno;
-		} else if (status == 0) {
-			return -EINVAL;
-		}
-		pr->bytes_recvd += status;
-		to_read -= status;
-	}
+	return 0;
+}
 
-	return 1;
+/*
+ * Release the memory held by a recvbuf, discarding any data it contains
+ * (wiping it first, since it may include clipboard contents, keystrokes,
+ * etc.).
+ */
+void clear_recvbuf(struct recvbuf* rb)
+{
+	if (rb->buf)
+		explicit_bzero(rb->buf, rb->size);
+	xfree(rb->buf);
+	rb->buf = NULL;
+	rb->size = rb->start = rb->end = 0;
 }
 
 /*
- * "Unflatten" the wire-protocol byte array in the given partrecv buffer into
- * a message struct, returning zero on success and negative on error.
+ * "Unflatten" the first complete message in the given recvbuf into a message
+ * struct, consuming it from the buffer.  Returns 1 if a message was parsed, 0
+ * if the buffer doesn't contain a complete message, and negative on error.
  */
-int parse_message(struct partrecv* pr, struct message* msg)
+int parse_message(struct recvbuf* rb, struct message* msg)
 {
 	XDR xdrs;
+	uint32_t hdr;
+	size_t len, avail = rb->end - rb->start;
+	const char* frame = rb->buf + rb->start;
+
+	if (avail < MSGHDR_SIZE)
+		return recvbuf_make_room(rb, MSGHDR_SIZE);
+
+	memcpy(&hdr, frame, sizeof(hdr));
+	hdr = ntohl(hdr);
 
-	xdrmem_create(&xdrs, pr->plbuf, pr->bytes_recvd - MSGHDR_SIZE, XDR_DECODE);
-	if (!xdr_msgbody(&xdrs, &msg->body)) {
-		fprintf(stderr, "xdr_msgbody() failed in parse_message() (invalid input?)\n");
-		return -1;
+	if (hdr & FIXEDMSG_FLAG) {
+		len = fixedmsg_payload_size(hdr & ~FIXEDMSG_FLAG);
+		if (!len)
+			return -EINVAL;
+	} else if (hdr & BATCHMSG_FLAG) {
+		len = hdr & ~BATCHMSG_FLAG;
+	} else {
+		len = hdr;
 	}
-	msg->from_xdr = 1;
-	xdr_destroy(&xdrs);
 
-	xfree(pr->plbuf);
-	pr->plbuf = NULL;
-	pr->bytes_recvd = 0;
+	if (avail < MSGHDR_SIZE + len)
+		return recvbuf_make_room(rb, MSGHDR_SIZE + len);
 
-	return 0;
+	/*
+	 * Once a whole batch is here, drop its header and parse the frames
+	 * it encloses as usual.  Batches can't be empty or nested, so this
+	 * recurses at most once.
+	 */
+	if (!(hdr & FIXEDMSG_FLAG) && (hdr & BATCHMSG_FLAG)) {
+		if (len < MSGHDR_SIZE)
+			return -EINVAL;
+		memcpy(&hdr, frame + MSGHDR_SIZE, sizeof(hdr));
+		hdr = ntohl(hdr);
+		if (!(hdr & FIXEDMSG_FLAG) && (hdr & BATCHMSG_FLAG))
+			return -EINVAL;
+		rb->start += MSGHDR_SIZE;
+		return parse_message(rb, msg);
+	}
+
+	msg->clip = NULL;
+
+	if (hdr & FIXEDMSG_FLAG) {
+		unpack_fixed_message(hdr & ~FIXEDMSG_FLAG, frame + MSGHDR_SIZE, msg);
+	} else {
+		msg->caps = 0;
+
+		xdrmem_create(&xdrs, (char*)frame + MSGHDR_SIZE, len, XDR_DECODE);
+		if (!xdr_msgbody(&xdrs, &msg->body)) {
+			fprintf(stderr, "xdr_msgbody() failed in parse_message() (invalid input?)\n");
+			return -EINVAL;
+		}
+		msg->from_xdr = 1;
+
+		/* Senders predating capability negotiation won't include a trailer */
+		if (has_caps_trailer(msg->body.type) && xdr_getpos(&xdrs) < len
+		    && !xdr_uint32_t(&xdrs, &msg->caps)) {
+			fprintf(stderr, "xdr_uint32_t() failed in parse_message() (invalid input?)\n");
+			return -EINVAL;
+		}
+
+		xdr_destroy(&xdrs);
+
+		/* Hand the decoded text over to a clipbuf instead of copying it */
+		if (msg->body.type == MT_SETCLIPBOARD)
+			msg->clip = new_clipbuf(MB(msg, setclipboard).text);
+	}
+
+	rb->start += MSGHDR_SIZE + len;
+
+	if (rb->start == rb->end) {
+		if (rb->size > RECVBUF_SIZE)
+			clear_recvbuf(rb);
+		else
+			rb->start = rb->end = 0;
+	}
+
+	return 1;
 }
 
+/*
+ * Every input event sent or relayed involves allocating and freeing a
+ * message struct (potentially thousands per second with a high-rate mouse),
+ * so rather than going through malloc() and free() for each one, freed
+ * messages are kept on a freelist for reuse.  This is how many we'll hold on
+ * to at most.
+ */
+#define MSGPOOL_MAX 64
+
+static struct {
+	struct message* freelist;
+	unsigned int num_free;
+
+	/* Allocations satisfied from the freelist vs. from malloc() */
+	unsigned long hits, misses;
+} msgpool;
+
 /* Allocate and return a new message of the given type. */
 struct message* new_message(msgtype_t type)
 {
-	struct message* msg = xmalloc(sizeof(*msg));
+	struct message* msg = msgpool.freelist;
+
+	if (msg) {
+		msgpool.freelist = msg->next;
+		msgpool.num_free -= 1;
+		msgpool.hits += 1;
+	} else {
+		msg = xmalloc(sizeof(*msg));
+		msgpool.misses += 1;
+	}
 
-	msg->body.type = type;
 	msg->next = NULL;
+	msg->body.type = type;
 	msg->from_xdr = 0;
+	msg->caps = 0;
+	msg->clip = NULL;
 
 	return msg;
 }
@@ -260,7 +845,7 @@ static void wipe_message(struct message* msg)
 	switch (msg->body.type) {
 	case MT_SETCLIPBOARD:
 		p = MB(msg, setclipboard).text;
-		sz = strlen(p);
+		sz = p ? strlen(p) : 0;
 		break;
 
 	case MT_KEYEVENT:
@@ -268,6 +853,11 @@ static void wipe_message(struct message* msg)
 		sz = sizeof(MB(msg, keyevent).keycode);
 		break;
 
+	case MT_CLIPCHUNK:
+		p = MB(msg, clipchunk).data.data_val;
+		sz = MB(msg, clipchunk).data.data_len;
+		break;
+
 	default:
 		break;
 	}
@@ -284,6 +874,13 @@ void free_msgbody(struct message* msg)
 {
 	int i;
 
+	/* The text belongs to the clipbuf, which wipes it when it's done with */
+	if (msg->clip) {
+		MB(msg, setclipboard).text = NULL;
+		clipbuf_put(msg->clip);
+		msg->clip = NULL;
+	}
+
 	wipe_message(msg);
 
 	if (msg->from_xdr) {
@@ -316,7 +913,28 @@ void free_msgbody(struct message* msg)
 void free_message(struct message* msg)
 {
 	free_msgbody(msg);
-	xfree(msg);
+
+	if (msgpool.num_free < MSGPOOL_MAX) {
+		msg->next = msgpool.freelist;
+		msgpool.freelist = msg;
+		msgpool.num_free += 1;
+	} else {
+		xfree(msg);
+	}
+}
+
+/* Log message-pool usage statistics and release the pool's memory. */
+void drain_msgpool(void)
+{
+	struct message* msg;
+
+	debug("message pool: %lu hits, %lu misses\n", msgpool.hits, msgpool.misses);
+
+	while ((msg = msgpool.freelist)) {
+		msgpool.freelist = msg->next;
+		xfree(msg);
+	}
+	msgpool.num_free = 0;
 }
 
 /* Would be nice if there were some easy way to generate this from proto.x... */
@@ -334,6 +952,15 @@ static const char* const msgtype_names[] = {
 	MTN(LOGMSG),
 	MTN(SETBRIGHTNESS),
 	MTN(SETLOGLEVEL),
+	MTN(EDGEEVENT),
+	MTN(CLIPBEGIN),
+	MTN(CLIPCHUNK),
+	MTN(CLIPEND),
+	MTN(GETCLIPHASH),
+	MTN(CLIPHASH),
+	MTN(CLIPOFFER),
+	MTN(CLIPZBEGIN),
+	MTN(SCROLL),
 #undef MTN
 };
 
@@ -342,3 +969,43 @@ const char* msgtype_name(msgtype_t type)
 	const char* name = type >= ARR_LEN(msgtype_names) ? "???" : msgtype_names[type];
 	return name ? name : "???";
 }
+
+static const struct {
+	uint32_t cap;
+	const char* name;
+} prot_cap_names[] = {
+	{ PROT_CAP_FIXEDMSG, "fixedmsg", },
+	{ PROT_CAP_EDGEEVENT, "edgeevent", },
+	{ PROT_CAP_CLIPCHUNKS, "clipchunks", },
+	{ PROT_CAP_CLIPHASH, "cliphash", },
+	{ PROT_CAP_CLIPLAZY, "cliplazy", },
+	{ PROT_CAP_BATCH, "batch", },
+	{ PROT_CAP_CLIPZLIB, "clipzlib", },
+	{ PROT_CAP_SCROLL, "scroll", },
+};
+
+/*
+ * Return a malloc()ed, human-readable list of the capabilities in the given
+ * PROT_CAP_* bitmask, for logging.
+ */
+char* prot_caps_str(uint32_t caps)
+{
+	int i;
+	char* tmp;
+	char* str = xstrdup("");
+
+	for (i = 0; i < ARR_LEN(prot_cap_names); i++) {
+		if (!(caps & prot_cap_names[i].cap))
+			continue;
+		tmp = xasprintf("%s%s%s", str, *str ? " " : "", prot_cap_names[i].name);
+		xfree(str);
+		str = tmp;
+	}
+
+	if (!*str) {
+		xfree(str);
+		str = xstrdup("none");
+	}
+
+	return str;
+}
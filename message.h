@@ -9,11 +9,52 @@
 
 #include "proto.h"
 
+/*
+ * Changing this breaks compatibility with every existing version (a remote
+ * refuses a SETUP with a version other than its own), so it should stay put;
+ * protocol extensions are added as capabilities instead.
+ */
 #define PROT_VERSION 0
 
+/*
+ * Optional wire-protocol capabilities.  Each end advertises the set it
+ * supports in the trailer of its SETUP or READY message (see the wire
+ * protocol comment in message.c); a feature is only used on a connection if
+ * both ends advertise it, so nodes running different versions fall back to
+ * whatever subset they have in common (possibly none, i.e. the original
+ * protocol).
+ */
+#define PROT_CAP_FIXEDMSG (1U << 0)
+#define PROT_CAP_EDGEEVENT (1U << 1)
+#define PROT_CAP_CLIPCHUNKS (1U << 2)
+#define PROT_CAP_CLIPHASH (1U << 3)
+#define PROT_CAP_CLIPLAZY (1U << 4)
+#define PROT_CAP_BATCH (1U << 5)
+#define PROT_CAP_CLIPZLIB (1U << 6)
+#define PROT_CAP_SCROLL (1U << 7)
+
+#define PROT_CAPS_SUPPORTED (PROT_CAP_FIXEDMSG|PROT_CAP_EDGEEVENT \
+                             |PROT_CAP_CLIPCHUNKS|PROT_CAP_CLIPHASH \
+                             |PROT_CAP_CLIPLAZY|PROT_CAP_BATCH \
+                             |PROT_CAP_CLIPZLIB|PROT_CAP_SCROLL)
+
 struct message {
 	struct msgbody body;
 
+	/*
+	 * Capability bitmask carried in the trailer of SETUP and READY
+	 * messages (ignored for all other message types).
+	 */
+	uint32_t caps;
+
+	/*
+	 * For SETCLIPBOARD messages, the buffer holding the clipboard text
+	 * (which the body's 'text' points to), of which the message holds a
+	 * reference.  Received messages get one too, so the text can be kept
+	 * (by taking another reference) without copying it.
+	 */
+	struct clipbuf* clip;
+
 	/*
 	 * Whether this message's body was filled in by XDR and thus should be
 	 * passed to xdr_free() for freeing instead passing individual members
@@ -21,7 +62,7 @@ struct message {
 	 */
 	int from_xdr;
 
-	/* For linking into a list (doesn't exist on the wire) */
+	/* For linking into the freelist of unused messages (see message.c) */
 	struct message* next;
 };
 
@@ -34,30 +75,137 @@ struct message {
  */
 #define MSGHDR_SIZE (sizeof(uint32_t))
 
-/* Buffer used for storing an incoming (possibly incomplete) message */
-struct partrecv {
-	char hdrbuf[MSGHDR_SIZE];
-	void* plbuf;
-	size_t bytes_recvd;
+/*
+ * Set in the header of a fixed-layout frame, in which case the remaining bits
+ * hold the message type instead of a length (see message.c).
+ */
+#define FIXEDMSG_FLAG (1U << 31)
+
+/*
+ * Set in the header of a batch frame (but not along with FIXEDMSG_FLAG), in
+ * which case the remaining bits hold the length of the frames it encloses.
+ */
+#define BATCHMSG_FLAG (1U << 30)
+
+/* Maximum total size of a fixed-layout frame */
+#define FIXEDMSG_MAXSIZE (MSGHDR_SIZE + 2 * sizeof(uint32_t))
+
+/*
+ * Buffer of received data not yet parsed into messages.  Unparsed data
+ * occupies [start, end) of buf, and may end with an incomplete message.
+ */
+struct recvbuf {
+	char* buf;
+	size_t size;
+	size_t start;
+	size_t end;
 };
 
-/* Buffer for storing an outgoing (possibly only partially-sent) message */
-struct partsend {
-	void* buf;
-	size_t len;
-	size_t bytes_sent;
+/*
+ * Buffer of serialized outgoing messages, the first of which may be partially
+ * sent.  Queued data occupies [start, end) of buf; space freed at the front by
+ * sending is reclaimed by sliding the remainder down when more is needed at
+ * the back, so each message is always contiguous and the whole backlog can go
+ * out in a single write().
+ */
+struct sendbuf {
+	char* buf;
+	size_t size;
+	size_t start;
+	size_t end;
+
+	/*
+	 * Offsets (in buf) of the end of each queued message, oldest first
+	 * (starting at index 'first'), so we know how many messages are
+	 * still pending.  MOVEREL messages aren't included (they're
+	 * coalesced instead; see coalesce_moverel()).
+	 */
+	struct {
+		size_t* ends;
+		unsigned int first;
+		unsigned int num;
+		unsigned int size;
+	} msgs;
+
+	/*
+	 * If the most recently queued message is a MOVEREL, the offsets of
+	 * its start and its dx field; start is SENDBUF_NONE otherwise.
+	 */
+	struct {
+		size_t start;
+		size_t dx;
+	} moverel;
+
+	/*
+	 * Set if the first message has been partially sent.  MOVERELs aren't
+	 * tracked individually, so this can be set spuriously when one has
+	 * just finished being sent, but is never wrongly clear.
+	 */
+	int partial;
+};
+
+#define SENDBUF_NONE SIZE_MAX
+
+/*
+ * A message to be queued to any number of msgchans (see
+ * mc_enqueue_shared()).  It's serialized at most once per wire form (XDR or
+ * fixed-layout, depending on the recipient's features), on first use, after
+ * which each recipient just copies the resulting frame into its sendbuf.
+ * MOVERELs (which get coalesced in place) and messages with a capability
+ * trailer can't be shared.
+ */
+struct sharedmsg {
+	struct message* msg;
+
+	/*
+	 * The serialized frame in each form (indexed by whether it's
+	 * fixed-layout), or NULL if that form hasn't been needed yet.
+	 */
+	struct {
+		char* buf;
+		size_t len;
+	} frames[2];
 };
 
+/*
+ * Number of messages (possibly including a partially-sent one, but excluding
+ * MOVERELs) in a sendbuf
+ */
+static inline unsigned int sendbuf_num_queued(const struct sendbuf* sb)
+{
+	return sb->msgs.num;
+}
+
+static inline int sendbuf_empty(const struct sendbuf* sb)
+{
+	return sb->start == sb->end;
+}
+
 struct message* new_message(msgtype_t type);
 void free_message(struct message* msg);
 void free_msgbody(struct message* msg);
+void drain_msgpool(void);
 
 const char* msgtype_name(msgtype_t type);
-
-int fill_msgbuf(int fd, struct partrecv* pr);
-int parse_message(struct partrecv* pr, struct message* msg);
-
-void unparse_message(const struct message* msg, struct partsend* ps);
-int drain_msgbuf(int fd, struct partsend* ps);
+char* prot_caps_str(uint32_t caps);
+
+int fill_recvbuf(int fd, struct recvbuf* rb);
+int parse_message(struct recvbuf* rb, struct message* msg);
+void clear_recvbuf(struct recvbuf* rb);
+
+size_t pack_fixed_message(const struct message* msg, void* buf);
+void unparse_message(const struct message* msg, struct sendbuf* sb,
+                     uint32_t features);
+int coalesce_moverel(struct sendbuf* sb, const struct message* msg);
+int drain_sendbuf(int fd, struct sendbuf* sb);
+int finish_sendbuf_msg(int fd, struct sendbuf* sb);
+size_t sendbuf_begin_batch(struct sendbuf* sb);
+void sendbuf_end_batch(struct sendbuf* sb, size_t hdr, int wrap);
+void clear_sendbuf(struct sendbuf* sb);
+void sendbuf_move(struct sendbuf* dst, struct sendbuf* src);
+
+struct sharedmsg* new_sharedmsg(struct message* msg);
+void append_sharedmsg(struct sharedmsg* sm, struct sendbuf* sb, uint32_t features);
+void free_sharedmsg(struct sharedmsg* sm);
 
 #endif /* PROTO_H */
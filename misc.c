@@ -135,16 +135,104 @@ struct kvmap* unflatten_kvmap(const struct kvpair* pairs, u_int numpairs)
 void set_clipboard_from_buf(const void* buf, size_t len)
 {
 	char* tmp;
+	struct clipbuf* cb;
 
-	/*
-	 * extra intermediate malloc()ed area just to tack on the NUL
-	 * terminator here is a bit inefficient...
-	 */
 	tmp = xmalloc(len + 1);
 	memcpy(tmp, buf, len);
 	tmp[len] = '\0';
-	set_clipboard_text(tmp);
-	xfree(tmp);
+
+	cb = new_clipbuf(tmp);
+	set_clipboard_text(cb);
+	clipbuf_put(cb);
+}
+
+/*
+ * Wrap a malloc()ed string (taking ownership of it) in a new clipbuf, with
+ * a single reference held by the caller.
+ */
+struct clipbuf* new_clipbuf(char* text)
+{
+	struct clipbuf* cb = xmalloc(sizeof(*cb));
+
+	cb->text = text;
+	cb->len = strlen(text);
+	cb->refcount = 1;
+	cb->hash = 0;
+	cb->z = NULL;
+
+	return cb;
+}
+
+/* Drop a reference to a clipbuf, wiping and freeing it if it was the last. */
+void clipbuf_put(struct clipbuf* cb)
+{
+	assert(cb->refcount > 0);
+
+	cb->refcount -= 1;
+	if (cb->refcount)
+		return;
+
+	if (cb->z)
+		free_clipzbuf(cb->z);
+
+	explicit_bzero(cb->text, cb->len);
+	xfree(cb->text);
+	xfree(cb);
+}
+
+/* Return clipboard_hash() of a clipbuf's text, computing it only once. */
+uint64_t clipbuf_hash(struct clipbuf* cb)
+{
+	if (!cb->hash)
+		cb->hash = clipboard_hash(cb->text);
+	return cb->hash;
+}
+
+/*
+ * Return a 64-bit FNV-1a hash of the given clipboard text, for cheaply
+ * checking whether two nodes' clipboards hold the same contents.  Never
+ * returns zero, so that can be used to mean "unknown".
+ */
+uint64_t clipboard_hash(const char* text)
+{
+	const unsigned char* p;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (p = (const unsigned char*)text; *p; p++) {
+		hash ^= *p;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash ? hash : 1;
+}
+
+/* Return the mask of screen edges the given point is at. */
+dirmask_t point_edgemask(struct xypoint pt, const struct rectangle* screen)
+{
+	dirmask_t mask = 0;
+
+	if (pt.x == screen->x.min)
+		mask |= LEFTMASK;
+	if (pt.x == screen->x.max)
+		mask |= RIGHTMASK;
+	if (pt.y == screen->y.min)
+		mask |= UPMASK;
+	if (pt.y == screen->y.max)
+		mask |= DOWNMASK;
+
+	return mask;
+}
+
+/*
+ * Return the position of the given point along the screen edge in direction
+ * 'dir' as a fraction of that edge's length.
+ */
+float edge_position(direction_t dir, struct xypoint pt, const struct rectangle* screen)
+{
+	if (dir == LEFT || dir == RIGHT)
+		return (float)pt.y / (float)screen->y.max;
+	else
+		return (float)pt.x / (float)screen->x.max;
 }
 
 /*
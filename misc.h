@@ -152,6 +152,7 @@ extern struct msgchan stdio_msgchan;
 void send_keyevent(struct remote* rmt, keycode_t kc, pressrel_t pr);
 void send_moverel(struct remote* rmt, int32_t dx, int32_t dy);
 void send_clickevent(struct remote* rmt, mousebutton_t button, pressrel_t pr);
+void send_scroll(struct remote* rmt, float dx, float dy);
 void send_setbrightness(struct remote* rmt, float f);
 
 int get_fd_nonblock(int fd);
@@ -164,6 +165,20 @@ struct kvpair* flatten_kvmap(const struct kvmap* kvm, u_int* numpairs);
 struct kvmap* unflatten_kvmap(const struct kvpair* pairs, u_int numpairs);
 
 void set_clipboard_from_buf(const void* buf, size_t len);
+uint64_t clipboard_hash(const char* text);
+
+struct clipbuf* new_clipbuf(char* text);
+void clipbuf_put(struct clipbuf* cb);
+uint64_t clipbuf_hash(struct clipbuf* cb);
+
+static inline struct clipbuf* clipbuf_get(struct clipbuf* cb)
+{
+	cb->refcount += 1;
+	return cb;
+}
+
+dirmask_t point_edgemask(struct xypoint pt, const struct rectangle* screen);
+float edge_position(direction_t dir, struct xypoint pt, const struct rectangle* screen);
 
 void explicit_bzero(void* p, size_t n);
 
@@ -1,157 +1,768 @@
 #include <errno.h>
+#include <stddef.h>
 
 #include "misc.h"
 #include "msgchan.h"
 
+/* Clipboard contents are potentially sensitive, so wipe before freeing. */
+static void wipe_and_free(char* p, size_t len)
+{
+	if (p)
+		explicit_bzero(p, len);
+	xfree(p);
+}
+
+/*
+ * zlib allocation functions that do likewise, since the compressor's and
+ * decompressor's internal state holds pieces of the clipboard contents.
+ */
+union zalloc_hdr {
+	size_t size;
+	max_align_t align;
+};
+
+static voidpf wiping_zalloc(voidpf opaque, uInt items, uInt size)
+{
+	union zalloc_hdr* hdr;
+
+	if (size && items > (SIZE_MAX - sizeof(*hdr)) / size)
+		return Z_NULL;
+
+	hdr = malloc(sizeof(*hdr) + (size_t)items * size);
+	if (!hdr)
+		return Z_NULL;
+
+	hdr->size = (size_t)items * size;
+	return hdr + 1;
+}
+
+static void wiping_zfree(voidpf opaque, voidpf addr)
+{
+	union zalloc_hdr* hdr = (union zalloc_hdr*)addr - 1;
+
+	explicit_bzero(hdr, sizeof(*hdr) + hdr->size);
+	free(hdr);
+}
+
+/*
+ * Size of the pieces a chunked clipboard transfer is sent in, and thus
+ * (roughly) the most clipboard data any other message can end up queued
+ * behind.
+ */
+#define CLIPCHUNK_SIZE (16 * 1024)
+
+/*
+ * Clipboard transfers shorter than this aren't worth compressing (if
+ * PROT_CAP_CLIPZLIB is available); it's the bulky ones stalling everything
+ * else on a slow link that we care about.
+ */
+#define CLIPZLIB_MIN_LEN (4 * 1024)
+
+static void free_clipxfer(struct mc_clipxfer* x)
+{
+	clipbuf_put(x->clip);
+	clear_sendbuf(&x->after);
+	xfree(x);
+}
+
+/* Abandon all outgoing clipboard transfers (and anything held behind them). */
+static void mc_drop_clipout(struct msgchan* mc)
+{
+	struct mc_clipxfer* x;
+
+	while (mc->clipout.queue) {
+		x = mc->clipout.queue;
+		mc->clipout.queue = x->next;
+		free_clipxfer(x);
+	}
+}
+
+/* The last queued clipboard transfer, or NULL if there aren't any. */
+static struct mc_clipxfer* mc_last_clipxfer(const struct msgchan* mc)
+{
+	struct mc_clipxfer* x = mc->clipout.queue;
+
+	while (x && x->next)
+		x = x->next;
+
+	return x;
+}
+
 /*
- * If there's at least one message in the send queue, pull one off and return
- * it; otherwise return NULL.
+ * The sendbuf a message of the given priority should be queued to: bulk
+ * messages enqueued while a clipboard transfer is pending are held back
+ * behind it.
  */
-static struct message* mc_dequeue_message(struct msgchan* mc)
+static struct sendbuf* mc_sendbuf(struct msgchan* mc, enum mc_prio prio)
 {
-	struct message* msg;
+	struct mc_clipxfer* last;
 
-	msg = mc->sendqueue.head;
+	if (prio == MC_PRIO_BULK && (last = mc_last_clipxfer(mc)))
+		return &last->after;
 
-	if (msg) {
-		mc->sendqueue.head = msg->next;
-		if (!msg->next)
-			mc->sendqueue.tail = NULL;
-		mc->sendqueue.num_queued -= 1;
+	return &mc->sendbuf[prio];
+}
+
+/* Abandon the incoming clipboard transfer, if there is one. */
+static void mc_drop_clipin(struct msgchan* mc)
+{
+	if (mc->clipin.inflating) {
+		inflateEnd(&mc->clipin.zs);
+		mc->clipin.inflating = 0;
 	}
 
-	return msg;
+	wipe_and_free(mc->clipin.data, mc->clipin.len);
+	mc->clipin.data = NULL;
 }
 
 /* Clear inbound & outbound message buffers */
 void mc_clear(struct msgchan* mc)
 {
-	struct message* msg;
+	int prio;
 
-	while ((msg = mc_dequeue_message(mc)))
-		free_message(msg);
+	if (mc->batch.flush)
+		cancel_call(mc->batch.flush);
+	memset(&mc->batch, 0, sizeof(mc->batch));
 
-	xfree(mc->send_msgbuf.buf);
-	mc->send_msgbuf.buf = NULL;
-	mc->send_msgbuf.bytes_sent = 0;
-	mc->send_msgbuf.len = 0;
+	for (prio = 0; prio < MC_NUM_PRIOS; prio++)
+		clear_sendbuf(&mc->sendbuf[prio]);
+	clear_recvbuf(&mc->recvbuf);
 
-	xfree(mc->recv_msgbuf.plbuf);
-	mc->recv_msgbuf.plbuf = NULL;
-	mc->recv_msgbuf.bytes_recvd = 0;
+	mc_drop_clipout(mc);
+	mc_drop_clipin(mc);
 }
 
-/*
- * Mamimum number of messages we'll buffer up in a msgchan's send queue before
- * calling the error handler.
- */
-#define MAX_SEND_BACKLOG 64
+void free_clipzbuf(struct clipzbuf* z)
+{
+	if (!z->done)
+		deflateEnd(&z->zs);
+
+	/* Only what's been produced so far needs wiping (or has been touched). */
+	wipe_and_free(z->data, z->len);
+	xfree(z);
+}
 
 /*
- * Enqueue a message to be sent.  Returns 0 on success, non-zero if the send
- * backlog is exceeded (i.e. if the send FD has blocked for too long).
+ * Return the compressed form of a clipbuf's text, setting it up if this is
+ * the first time it's wanted.  Returns NULL if it's unavailable (in which
+ * case the text can just be sent as-is).
  */
-int mc_enqueue_message(struct msgchan* mc, struct message* msg)
+static struct clipzbuf* get_clipzbuf(struct clipbuf* clip)
 {
-	msg->next = NULL;
-	if (mc->sendqueue.tail)
-		mc->sendqueue.tail->next = msg;
-	mc->sendqueue.tail = msg;
-	if (!mc->sendqueue.head)
-		mc->sendqueue.head = msg;
-	mc->sendqueue.num_queued += 1;
+	struct clipzbuf* z = clip->z;
+
+	if (z)
+		return z->done < 0 ? NULL : z;
+
+	z = xmalloc(sizeof(*z));
+	memset(&z->zs, 0, sizeof(z->zs));
+	z->zs.zalloc = wiping_zalloc;
+	z->zs.zfree = wiping_zfree;
 
-	fdmon_monitor(mc->send.mon, FM_WRITE);
+	/* Speed over ratio: the point is to not hold up the link. */
+	if (deflateInit(&z->zs, Z_BEST_SPEED) != Z_OK) {
+		warn("failed to initialize clipboard compression\n");
+		xfree(z);
+		return NULL;
+	}
 
-	return mc->sendqueue.num_queued > MAX_SEND_BACKLOG ? -1 : 0;
+	/*
+	 * Allocating the worst-case size up front means never having to copy
+	 * (and wipe) it as it grows; pages that never get written aren't
+	 * really used anyway.
+	 */
+	z->size = deflateBound(&z->zs, clip->len);
+	z->data = xmalloc(z->size);
+	z->len = 0;
+	z->done = 0;
+
+	z->zs.next_in = (Bytef*)clip->text;
+	z->zs.avail_in = clip->len;
+
+	clip->z = z;
+	return z;
 }
 
 /*
- * Attempt to finish sending an in-progress message or start sending the next
- * one in the send queue.  Returns positive if some data was sent, zero if
- * nothing was queued, and negative on error.
+ * Compress up to another chunk's worth of a clipbuf's text.  Returns zero on
+ * success, negative on failure.
  */
-static int send_message(struct msgchan* mc)
+static int produce_clipzbuf(struct clipbuf* clip)
 {
 	int status;
-	struct message* msg;
+	struct clipzbuf* z = clip->z;
+
+	z->zs.next_out = (Bytef*)z->data + z->len;
+	z->zs.avail_out = z->size - z->len;
+	if (z->zs.avail_out > CLIPCHUNK_SIZE)
+		z->zs.avail_out = CLIPCHUNK_SIZE;
+
+	/* All the input is already there, so we can always say Z_FINISH. */
+	status = deflate(&z->zs, Z_FINISH);
+	z->len = (char*)z->zs.next_out - z->data;
+
+	if (status == Z_OK)
+		return 0;
+
+	if (status == Z_STREAM_END) {
+		debug("clipboard compressed from %zu to %zu bytes\n", clip->len, z->len);
+		z->done = 1;
+	} else {
+		errlog("clipboard compression failed: %s\n",
+		       z->zs.msg ? z->zs.msg : "???");
+		z->done = -1;
+	}
 
-	if (!mc->send_msgbuf.buf) {
-		msg = mc_dequeue_message(mc);
-		if (!msg)
-			return 0;
-		mc->send_msgbuf.bytes_sent = 0;
-		unparse_message(msg, &mc->send_msgbuf);
-		free_message(msg);
+	deflateEnd(&z->zs);
+	return z->done < 0 ? -1 : 0;
+}
+
+/*
+ * Start the first queued clipboard transfer.  Only the CLIPBEGIN (or
+ * CLIPZBEGIN) is queued here; see mc_feed_clipboard() for the rest.
+ */
+static void mc_start_clipxfer(struct msgchan* mc)
+{
+	struct message begin = { .body.type = MT_CLIPBEGIN, };
+	struct clipbegin_body* body = &MB(&begin, clipbegin);
+	struct clipbuf* clip = mc->clipout.queue->clip;
+
+	mc->clipout.sent = 0;
+	mc->clipout.id += 1;
+	mc->clipout.compressed = (mc->features & PROT_CAP_CLIPZLIB)
+		&& clip->len >= CLIPZLIB_MIN_LEN && get_clipzbuf(clip);
+
+	if (mc->clipout.compressed) {
+		begin.body.type = MT_CLIPZBEGIN;
+		body = &MB(&begin, clipzbegin);
 	}
 
-	status = drain_msgbuf(mc->send.fd, &mc->send_msgbuf);
+	body->id = mc->clipout.id;
+	body->len = clip->len;
+	unparse_message(&begin, &mc->sendbuf[MC_PRIO_BULK], mc->features);
+}
 
-	return status < 0 ? status : 1;
+/*
+ * Finish with the first queued clipboard transfer (whether or not all of it
+ * has been sent), releasing whatever was held behind it and starting the
+ * next one, if any.
+ */
+static void mc_finish_clipxfer(struct msgchan* mc)
+{
+	struct mc_clipxfer* x = mc->clipout.queue;
+
+	mc->clipout.queue = x->next;
+	sendbuf_move(&mc->sendbuf[MC_PRIO_BULK], &x->after);
+	free_clipxfer(x);
+
+	if (mc->clipout.queue)
+		mc_start_clipxfer(mc);
 }
 
 /*
- * Read in (possibly only part of) a message.  Returns positive if a complete
- * message has been read, zero if the incoming message is still incomplete,
- * and negative on error.
+ * Drop the last queued clipboard transfer if nothing's been queued after
+ * it, since a newer clipboard update is about to make it moot.  (If it's
+ * in progress, the recipient discards the partial transfer at the next
+ * one.)
  */
-static int recv_message(struct msgchan* mc, struct message* msg)
+static void mc_supersede_clipxfer(struct msgchan* mc)
 {
-	int status;
+	struct mc_clipxfer** xp = &mc->clipout.queue;
+
+	if (!*xp)
+		return;
+
+	while ((*xp)->next)
+		xp = &(*xp)->next;
 
-	status = fill_msgbuf(mc->recv.fd, &mc->recv_msgbuf);
-	if (status <= 0)
-		return status;
+	if (!sendbuf_empty(&(*xp)->after))
+		return;
+
+	free_clipxfer(*xp);
+	*xp = NULL;
+}
 
-	status = parse_message(&mc->recv_msgbuf, msg);
-	if (status < 0)
-		return status;
+/*
+ * Queue a chunked transfer of the given clipboard text (taking over the
+ * caller's reference to it), superseding the last queued transfer if
+ * nothing has been queued behind it.
+ */
+static void mc_queue_clipboard(struct msgchan* mc, struct clipbuf* clip)
+{
+	struct mc_clipxfer** xp;
+	struct mc_clipxfer* x = xcalloc(sizeof(*x));
+
+	x->clip = clip;
+	clear_sendbuf(&x->after);
+
+	mc_supersede_clipxfer(mc);
+
+	for (xp = &mc->clipout.queue; *xp; xp = &(*xp)->next)
+		;
+	*xp = x;
+
+	if (x == mc->clipout.queue)
+		mc_start_clipxfer(mc);
+}
+
+/*
+ * Queue the next piece of the outgoing clipboard transfer, if there is one
+ * (followed by the CLIPEND if it's the last piece).  Returns non-zero if
+ * anything was queued.
+ */
+static int mc_feed_clipboard(struct msgchan* mc)
+{
+	int last;
+	size_t len, total;
+	const char* data;
+	struct clipbuf* clip;
+	struct message chunk = { .body.type = MT_CLIPCHUNK, };
+	struct message end = { .body.type = MT_CLIPEND, };
+
+	if (!mc->clipout.queue)
+		return 0;
+
+	clip = mc->clipout.queue->clip;
+
+	if (mc->clipout.compressed) {
+		/* Someone else may have already compressed this far */
+		if (!clip->z->done && clip->z->len - mc->clipout.sent < CLIPCHUNK_SIZE)
+			produce_clipzbuf(clip);
+
+		if (clip->z->done < 0) {
+			/* The recipient discards the partial transfer at the next one. */
+			mc_finish_clipxfer(mc);
+			return !sendbuf_empty(&mc->sendbuf[MC_PRIO_BULK]);
+		}
+
+		data = clip->z->data;
+		total = clip->z->len;
+		last = clip->z->done;
+	} else {
+		data = clip->text;
+		total = clip->len;
+		last = 1;
+	}
+
+	len = total - mc->clipout.sent;
+	if (len > CLIPCHUNK_SIZE)
+		len = CLIPCHUNK_SIZE;
+
+	if (len) {
+		MB(&chunk, clipchunk).id = mc->clipout.id;
+		MB(&chunk, clipchunk).data.data_val = (char*)data + mc->clipout.sent;
+		MB(&chunk, clipchunk).data.data_len = len;
+		unparse_message(&chunk, &mc->sendbuf[MC_PRIO_BULK], mc->features);
+		mc->clipout.sent += len;
+	}
+
+	if (last && mc->clipout.sent == total) {
+		MB(&end, clipend).id = mc->clipout.id;
+		unparse_message(&end, &mc->sendbuf[MC_PRIO_BULK], mc->features);
+		mc_finish_clipxfer(mc);
+	}
 
 	return 1;
 }
 
 /*
- * fdmon callback for a msgchan's receive-side file descriptor (called when
- * the file descriptor is ready to be read).  Attemps to pull in a message,
- * calling the msgchan's recv callback if a complete message has arrived.
+ * Decompress a received CLIPCHUNK of a compressed transfer into clipin.data.
+ * Returns zero on success, negative on error.
  */
-static void mc_read_cb(struct fdmon_ctx* ctx, void* arg)
+static int mc_inflate_chunk(struct msgchan* mc, const struct clipchunk_body* chunk)
 {
-	struct msgchan* mc;
-	struct message msg;
 	int status;
+	z_stream* zs = &mc->clipin.zs;
+
+	if (mc->clipin.zdone)
+		return chunk->data.data_len ? -EINVAL : 0;
+
+	zs->next_in = (Bytef*)chunk->data.data_val;
+	zs->avail_in = chunk->data.data_len;
+	zs->next_out = (Bytef*)mc->clipin.data + mc->clipin.received;
+	zs->avail_out = mc->clipin.len - mc->clipin.received;
+
+	status = inflate(zs, Z_NO_FLUSH);
+	mc->clipin.received = mc->clipin.len - zs->avail_out;
+
+	if (status == Z_STREAM_END)
+		mc->clipin.zdone = 1;
+	else if (status != Z_OK && status != Z_BUF_ERROR)
+		return -EINVAL;
 
 	/*
-	 * Apparently the XDR code requires this, though I can't find it
-	 * documented anywhere (sigh).  Without it, anything involving
-	 * pointers inside msg.body (strings, arrays) goes haywire.
+	 * Unconsumed input means it inflates to more than the announced
+	 * length (or there's junk after the end of the stream); the length
+	 * bounds what we'll allocate, so it's not to be exceeded.
 	 */
-	memset(&msg.body, 0, sizeof(msg.body));
+	return zs->avail_in ? -EINVAL : 0;
+}
+
+/*
+ * Handle a received piece of a chunked clipboard transfer.  Returns 1 (with
+ * 'setclip' filled in as the equivalent SETCLIPBOARD message) when a transfer
+ * is completed, 0 if it's not yet, and negative on error.
+ */
+static int mc_recv_clipboard(struct msgchan* mc, const struct message* msg,
+                             struct message* setclip)
+{
+	const struct clipbegin_body* begin;
+	const struct clipchunk_body* chunk;
+
+	switch (msg->body.type) {
+	case MT_CLIPBEGIN:
+	case MT_CLIPZBEGIN:
+		begin = msg->body.type == MT_CLIPZBEGIN ? &MB(msg, clipzbegin)
+			: &MB(msg, clipbegin);
+
+		mc_drop_clipin(mc);
+
+		/*
+		 * As with recvbuf_make_room(), the size comes straight off
+		 * the wire, so a failure here should fail the peer instead
+		 * of killing us.
+		 */
+		mc->clipin.data = malloc((size_t)begin->len + 1);
+		if (!mc->clipin.data)
+			return -ENOMEM;
+
+		mc->clipin.len = begin->len;
+		mc->clipin.received = 0;
+		mc->clipin.id = begin->id;
+
+		if (msg->body.type == MT_CLIPZBEGIN) {
+			memset(&mc->clipin.zs, 0, sizeof(mc->clipin.zs));
+			mc->clipin.zs.zalloc = wiping_zalloc;
+			mc->clipin.zs.zfree = wiping_zfree;
+			if (inflateInit(&mc->clipin.zs) != Z_OK)
+				return -ENOMEM;
+			mc->clipin.inflating = 1;
+			mc->clipin.zdone = 0;
+		}
+		return 0;
+
+	case MT_CLIPCHUNK:
+		chunk = &MB(msg, clipchunk);
+		if (!mc->clipin.data || chunk->id != mc->clipin.id)
+			return -EINVAL;
+
+		if (mc->clipin.inflating)
+			return mc_inflate_chunk(mc, chunk);
+
+		if (chunk->data.data_len > mc->clipin.len - mc->clipin.received)
+			return -EINVAL;
+
+		memcpy(mc->clipin.data + mc->clipin.received, chunk->data.data_val,
+		       chunk->data.data_len);
+		mc->clipin.received += chunk->data.data_len;
+		return 0;
+
+	case MT_CLIPEND:
+		if (!mc->clipin.data || MB(msg, clipend).id != mc->clipin.id
+		    || mc->clipin.received != mc->clipin.len
+		    || (mc->clipin.inflating && !mc->clipin.zdone))
+			return -EINVAL;
+
+		mc->clipin.data[mc->clipin.len] = '\0';
+
+		memset(setclip, 0, sizeof(*setclip));
+		setclip->body.type = MT_SETCLIPBOARD;
+		setclip->clip = new_clipbuf(mc->clipin.data);
+		MB(setclip, setclipboard).text = setclip->clip->text;
+		mc->clipin.data = NULL;
+		mc_drop_clipin(mc);
+		return 1;
+
+	default:
+		abort();
+	}
+}
 
-	mc = arg;
+static enum mc_prio msg_prio(msgtype_t type)
+{
+	switch (type) {
+	case MT_KEYEVENT:
+	case MT_CLICKEVENT:
+	case MT_MOVEREL:
+	case MT_MOVEABS:
+	case MT_MOUSEPOS:
+	case MT_EDGEEVENT:
+	case MT_SCROLL:
+		return MC_PRIO_INTERACTIVE;
+
+	default:
+		return MC_PRIO_BULK;
+	}
+}
 
-	status = recv_message(mc, &msg);
-	if (!status)
-		return;
-	else if (status < 0)
-		mc->cb.err(mc, mc->cb.arg, errno);
-	else {
-		mc->cb.recv(mc, &msg, mc->cb.arg);
-		free_msgbody(&msg);
+/*
+ * Mamimum number of messages of each priority class we'll buffer up in a
+ * msgchan's send queue before calling the error handler.  Pointer motion
+ * doesn't count toward this, since consecutive MOVERELs are merged while
+ * waiting to be sent.  Bulk traffic gets more leeway, since it can be starved
+ * by interactive traffic and bursts of log messages are normal at high log
+ * levels.
+ */
+static const unsigned int max_send_backlog[MC_NUM_PRIOS] = {
+	[MC_PRIO_INTERACTIVE] = 64,
+	[MC_PRIO_BULK] = 256,
+};
+
+static int mc_sendbufs_empty(const struct msgchan* mc)
+{
+	int prio;
+
+	for (prio = 0; prio < MC_NUM_PRIOS; prio++) {
+		if (!sendbuf_empty(&mc->sendbuf[prio]))
+			return 0;
 	}
+
+	return 1;
 }
 
 /* Does this msgchan have any data to be sent? */
 static inline int mc_have_outbound_data(const struct msgchan* mc)
 {
-	return mc->send_msgbuf.buf || mc->sendqueue.head;
+	return !mc_sendbufs_empty(mc) || mc->clipout.queue;
+}
+
+/* Finish the batch being accumulated (if any) so it can be sent. */
+static void mc_end_batch(struct msgchan* mc)
+{
+	int wrap;
+
+	if (!mc->batch.open)
+		return;
+
+	if (mc->batch.flush) {
+		cancel_call(mc->batch.flush);
+		mc->batch.flush = NULL;
+	}
+
+	wrap = mc->batch.nframes > 1 && (mc->features & PROT_CAP_BATCH);
+	sendbuf_end_batch(&mc->sendbuf[MC_PRIO_INTERACTIVE], mc->batch.hdr, wrap);
+	mc->batch.open = 0;
+}
+
+/*
+ * Send as much queued data as we can, highest priority first (but finishing
+ * any partially-sent message before anything else).  Returns 1 if everything
+ * was sent, 0 if the send FD would block, and negative on error.
+ */
+static int mc_drain(struct msgchan* mc)
+{
+	int prio, status;
+
+	mc_end_batch(mc);
+
+	for (prio = 0; prio < MC_NUM_PRIOS; prio++) {
+		status = finish_sendbuf_msg(mc->send.fd, &mc->sendbuf[prio]);
+		if (status <= 0)
+			return status;
+	}
+
+	for (prio = 0; prio < MC_NUM_PRIOS; prio++) {
+		status = drain_sendbuf(mc->send.fd, &mc->sendbuf[prio]);
+		if (status <= 0)
+			return status;
+	}
+
+	return 1;
+}
+
+/*
+ * Try to send everything queued, leaving whatever can't be sent right away
+ * for mc_write_cb().
+ */
+static void mc_kick(struct msgchan* mc)
+{
+	/*
+	 * Errors are left for mc_write_cb() to report so that callers don't
+	 * have the msgchan torn down out from under them.  If this drains
+	 * everything, the next clipboard chunk (if any) is left for
+	 * mc_write_cb() as well, so that input arriving meanwhile can get in
+	 * ahead of it.
+	 */
+	if (mc_drain(mc) <= 0 || mc->clipout.queue)
+		fdmon_monitor(mc->send.mon, FM_WRITE);
+}
+
+/* Scheduled call to send a batch at the end of an event-loop iteration. */
+static void mc_flush_cb(void* arg)
+{
+	struct msgchan* mc = arg;
+
+	mc->batch.flush = NULL;
+	mc_kick(mc);
+}
+
+/*
+ * Common setup for enqueuing a message: open a batch if appropriate, and
+ * return whether there was nothing already waiting to be sent.
+ */
+static int mc_prepare_enqueue(struct msgchan* mc)
+{
+	if (mc->batch_limit && !mc->batch.open && !mc_have_outbound_data(mc)) {
+		mc->batch.hdr = sendbuf_begin_batch(&mc->sendbuf[MC_PRIO_INTERACTIVE]);
+		mc->batch.nframes = 0;
+		mc->batch.flush = schedule_call(mc_flush_cb, mc, NULL, 0);
+		mc->batch.open = 1;
+	}
+
+	return mc_sendbufs_empty(mc);
+}
+
+/*
+ * Common completion of enqueuing a message of the given priority to the
+ * given sendbuf: get it on its way, and check the backlog.
+ */
+static int mc_finish_enqueue(struct msgchan* mc, enum mc_prio prio,
+                             struct sendbuf* sb, int was_idle)
+{
+	struct sendbuf* isb = &mc->sendbuf[MC_PRIO_INTERACTIVE];
+
+	if (mc->batch.open) {
+		if (isb->end - mc->batch.hdr >= mc->batch_limit)
+			mc_kick(mc);
+	} else if (!was_idle) {
+		fdmon_monitor(mc->send.mon, FM_WRITE);
+	} else {
+		mc_kick(mc);
+	}
+
+	return sendbuf_num_queued(sb) > max_send_backlog[prio] ? -1 : 0;
+}
+
+/*
+ * Enqueue a message to be sent, consuming it.  The message is serialized
+ * immediately (or for a MOVEREL, possibly merged into a still-unsent one
+ * queued just before it); if nothing else was already waiting to be sent we
+ * also try to write it out right away rather than waiting for the event loop
+ * to report the send FD writable (unless batching is enabled, in which case
+ * it's sent along with whatever else gets enqueued before the end of the
+ * current event-loop iteration).  Returns 0 on success, non-zero if the send
+ * backlog is exceeded (i.e. if the send FD has blocked for too long).
+ */
+int mc_enqueue_message(struct msgchan* mc, struct message* msg)
+{
+	int was_idle = mc_prepare_enqueue(mc);
+	enum mc_prio prio = msg_prio(msg->body.type);
+	struct sendbuf* sb;
+
+	/* An offer of newer clipboard contents makes a pending transfer moot */
+	if (msg->body.type == MT_CLIPOFFER)
+		mc_supersede_clipxfer(mc);
+	sb = mc_sendbuf(mc, prio);
+
+	if (msg->body.type == MT_SETCLIPBOARD && (mc->features & PROT_CAP_CLIPCHUNKS)) {
+		mc_queue_clipboard(mc, clipbuf_get(msg->clip));
+		sb = &mc->sendbuf[prio];
+	} else if (!coalesce_moverel(sb, msg)) {
+		unparse_message(msg, sb, mc->features);
+		if (mc->batch.open && sb == &mc->sendbuf[MC_PRIO_INTERACTIVE])
+			mc->batch.nframes += 1;
+	}
+	free_message(msg);
+
+	return mc_finish_enqueue(mc, prio, sb, was_idle);
+}
+
+/*
+ * Like mc_enqueue_message(), but for a message being sent to several
+ * msgchans (and which thus remains the caller's): it's serialized only the
+ * first time, and clipboard text is shared rather than copied.
+ */
+int mc_enqueue_shared(struct msgchan* mc, struct sharedmsg* sm)
+{
+	int was_idle = mc_prepare_enqueue(mc);
+	enum mc_prio prio = msg_prio(sm->msg->body.type);
+	struct sendbuf* sb;
+
+	/* An offer of newer clipboard contents makes a pending transfer moot */
+	if (sm->msg->body.type == MT_CLIPOFFER)
+		mc_supersede_clipxfer(mc);
+	sb = mc_sendbuf(mc, prio);
+
+	if (sm->msg->body.type == MT_SETCLIPBOARD && (mc->features & PROT_CAP_CLIPCHUNKS)) {
+		mc_queue_clipboard(mc, clipbuf_get(sm->msg->clip));
+		sb = &mc->sendbuf[prio];
+	} else {
+		append_sharedmsg(sm, sb, mc->features);
+		if (mc->batch.open && sb == &mc->sendbuf[MC_PRIO_INTERACTIVE])
+			mc->batch.nframes += 1;
+	}
+
+	return mc_finish_enqueue(mc, prio, sb, was_idle);
+}
+
+/*
+ * fdmon callback for a msgchan's receive-side file descriptor (called when
+ * the file descriptor is ready to be read).  Pulls in as much data as is
+ * available and calls the msgchan's recv callback for every complete message
+ * received, leaving any trailing partial message buffered for next time.
+ */
+static void mc_read_cb(struct fdmon_ctx* ctx, void* arg)
+{
+	struct msgchan* mc = arg;
+	struct message msg, setclip;
+	int status;
+
+	status = fill_recvbuf(mc->recv.fd, &mc->recvbuf);
+	if (!status)
+		return;
+	else if (status < 0) {
+		mc->cb.err(mc, mc->cb.arg, -status);
+		return;
+	}
+
+	for (;;) {
+		/*
+		 * Apparently the XDR code requires this, though I can't find
+		 * it documented anywhere (sigh).  Without it, anything
+		 * involving pointers inside msg.body (strings, arrays) goes
+		 * haywire.
+		 */
+		memset(&msg.body, 0, sizeof(msg.body));
+
+		status = parse_message(&mc->recvbuf, &msg);
+		if (!status)
+			break;
+		else if (status < 0) {
+			mc->cb.err(mc, mc->cb.arg, -status);
+			break;
+		}
+
+		if (msg.body.type == MT_CLIPBEGIN || msg.body.type == MT_CLIPZBEGIN
+		    || msg.body.type == MT_CLIPCHUNK || msg.body.type == MT_CLIPEND) {
+			status = mc_recv_clipboard(mc, &msg, &setclip);
+			free_msgbody(&msg);
+			if (status < 0) {
+				mc->cb.err(mc, mc->cb.arg, -status);
+				break;
+			} else if (status > 0) {
+				mc->cb.recv(mc, &setclip, mc->cb.arg);
+				free_msgbody(&setclip);
+			}
+		} else {
+			mc->cb.recv(mc, &msg, mc->cb.arg);
+			free_msgbody(&msg);
+		}
+
+		/*
+		 * The recv callback may have closed (and possibly even
+		 * re-initialized) the msgchan, in which case whatever's left
+		 * in the buffer is no longer ours to process.
+		 */
+		if (mc->recv.mon != ctx)
+			break;
+	}
 }
 
 /*
  * fdmon callback for a msgchan's send-side file descriptor (called when the
- * file descriptor is ready to be written to).  Attempts to complete the
- * transmission of a partially-sent message if one is in progress, or starts
- * sending the next message in the send queue (perhaps completing it).
+ * file descriptor is ready to be written to).  Attempts to send everything
+ * in the msgchan's send buffers, then refills them with the next piece of any
+ * outgoing clipboard transfer (to be sent next time around).
  */
 static void mc_write_cb(struct fdmon_ctx* ctx, void* arg)
 {
@@ -164,11 +775,14 @@ static void mc_write_cb(struct fdmon_ctx* ctx, void* arg)
 		return;
 	}
 
-	status = send_message(mc);
-	if (status < 0)
-		mc->cb.err(mc, mc->cb.arg, errno);
-	else
-		assert(status == 1);
+	status = mc_drain(mc);
+	if (status < 0) {
+		mc->cb.err(mc, mc->cb.arg, -status);
+		return;
+	}
+
+	if (status > 0)
+		mc_feed_clipboard(mc);
 
 	if (mc_have_outbound_data(mc))
 		fdmon_monitor(ctx, FM_WRITE);
@@ -181,6 +795,8 @@ void mc_init(struct msgchan* mc, int send_fd, int recv_fd, mc_recv_cb_t recv_cb,
              mc_err_cb_t err_cb, void* cb_arg)
 {
 	mc_clear(mc);
+	mc->features = 0;
+	mc->batch_limit = 0;
 	mc->send.fd = send_fd;
 	mc->recv.fd = recv_fd;
 
@@ -205,6 +821,7 @@ void mc_close(struct msgchan* mc)
 
 	fdmon_unregister(mc->send.mon);
 	fdmon_unregister(mc->recv.mon);
+	mc->send.mon = mc->recv.mon = NULL;
 
 	close(mc->send.fd);
 	if (mc->recv.fd != mc->send.fd)
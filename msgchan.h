@@ -1,31 +1,133 @@
 /*
  * Bidirectional async message channels.
  *
- * On the sending path, buffers messages if the output file descriptor blocks.
+ * On the sending path, serializes messages as they're enqueued and buffers
+ * them if the output file descriptor blocks (or optionally to send several
+ * together).
  *
- * On the receiving path, calls a handler function when a message is received.
+ * On the receiving path, calls a handler function for each message received.
  */
 
 #ifndef MSGCHAN_H
 #define MSGCHAN_H
 
+#include <zlib.h>
+
 #include "message.h"
 #include "events.h"
 
 struct msgchan;
 
+/*
+ * The zlib-compressed form of a clipbuf's text (see PROT_CAP_CLIPZLIB),
+ * shared by all msgchans sending it.  It's produced incrementally as they
+ * send it, only ever as far as the furthest along of them has needed, so
+ * that however many remotes get it, it's compressed just once.
+ */
+struct clipzbuf {
+	z_stream zs;
+	char* data;
+	size_t len, size;
+
+	/* 1 once the stream is complete, -1 if compressing it failed */
+	int done;
+};
+
+void free_clipzbuf(struct clipzbuf* z);
+
+/*
+ * A queued outgoing chunked clipboard transfer (see CLIPBEGIN in proto.x),
+ * along with any bulk messages enqueued after it, which are held back until
+ * its CLIPEND has been queued so that they don't overtake it.
+ */
+struct mc_clipxfer {
+	struct clipbuf* clip;
+	struct sendbuf after;
+	struct mc_clipxfer* next;
+};
+
 typedef void (*mc_recv_cb_t)(struct msgchan* chan, struct message* msg, void* arg);
 typedef void (*mc_err_cb_t)(struct msgchan* chan, void* arg, int err);
 
+/*
+ * Priority classes of outgoing messages, highest first.  Queued messages of a
+ * higher class are always sent before those of a lower one (though a message
+ * that's already been partially sent is finished first).  Within a class,
+ * messages are sent in the order they were enqueued, chunked clipboard
+ * transfers included.
+ */
+enum mc_prio {
+	/* Input events and pointer-position feedback */
+	MC_PRIO_INTERACTIVE,
+
+	/* Everything else: clipboard data, log messages, setup, etc. */
+	MC_PRIO_BULK,
+
+	MC_NUM_PRIOS,
+};
+
 struct msgchan {
 	struct {
 		int fd;
 		struct fdmon_ctx* mon;
 	} send, recv;
 
-	/* For buffering partial inbound & outbound messages */
-	struct partrecv recv_msgbuf;
-	struct partsend send_msgbuf;
+	/* Optional protocol features (PROT_CAP_*) negotiated with the peer */
+	uint32_t features;
+
+	/* Received data not yet parsed into messages */
+	struct recvbuf recvbuf;
+
+	/* Serialized messages waiting to be sent, one buffer per mc_prio */
+	struct sendbuf sendbuf[MC_NUM_PRIOS];
+
+	/*
+	 * If non-zero, messages enqueued while the msgchan is idle are held
+	 * back until the end of the current event-loop iteration, or until
+	 * this many bytes have accumulated, and then written out together
+	 * (wrapped in a single batch frame if PROT_CAP_BATCH has been
+	 * negotiated).  If zero, each is written out immediately.
+	 */
+	size_t batch_limit;
+
+	/*
+	 * Batch currently being accumulated: the offset of its header in the
+	 * MC_PRIO_INTERACTIVE sendbuf (lower-priority messages are just held
+	 * back, not batched), how many frames it contains, and the scheduled
+	 * call that will send it.
+	 */
+	struct {
+		int open;
+		size_t hdr;
+		unsigned int nframes;
+		timer_ctx_t flush;
+	} batch;
+
+	/*
+	 * Outgoing chunked clipboard transfers, oldest first.  The first one
+	 * is in progress, fed into sendbuf a chunk at a time as it drains
+	 * straight from the (shared) clipbuf; 'sent', 'id' and 'compressed'
+	 * pertain to it.  If 'compressed' is set, the data sent is the
+	 * clipbuf's compressed form (clip->z), and 'sent' is an offset in
+	 * that.  'queue' is NULL if there aren't any.
+	 */
+	struct {
+		struct mc_clipxfer* queue;
+		size_t sent;
+		uint32_t id;
+		int compressed;
+	} clipout;
+
+	/* Incoming chunked clipboard transfer being reassembled */
+	struct {
+		char* data;
+		size_t len;
+		size_t received;
+		uint32_t id;
+		int inflating;
+		int zdone;
+		z_stream zs;
+	} clipin;
 
 	/* Callbacks */
 	struct {
@@ -38,18 +140,25 @@ struct msgchan {
 		/* Opaque argument passed to callbacks */
 		void* arg;
 	} cb;
-
-	/* Buffer of pending messages to be sent */
-	struct {
-		struct message* head;
-		struct message* tail;
-		int num_queued;
-	} sendqueue;
 };
 
+/*
+ * Number of interactive (input-event) messages queued to the given msgchan
+ * that it hasn't yet been able to write out.  Anything in a still-open batch
+ * was enqueued during the current event-loop iteration and hasn't had a
+ * chance to go anywhere yet, so it isn't counted.
+ */
+static inline unsigned int mc_input_backlog(const struct msgchan* mc)
+{
+	if (mc->batch.open)
+		return 0;
+	return sendbuf_num_queued(&mc->sendbuf[MC_PRIO_INTERACTIVE]);
+}
+
 void mc_clear(struct msgchan* mc);
 
 int mc_enqueue_message(struct msgchan* mc, struct message* msg);
+int mc_enqueue_shared(struct msgchan* mc, struct sharedmsg* sm);
 
 void mc_init(struct msgchan* mc, int send_fd, int recv_fd,
              mc_recv_cb_t recv_cb, mc_err_cb_t err_cb, void* cb_arg);
@@ -561,6 +561,11 @@ void move_mousepos(int32_t dx, int32_t dy)
 		set_mousepos_cgpoint(pt);
 }
 
+void flush_input_events(void)
+{
+	/* CGEventPost() doesn't buffer anything; nothing to do. */
+}
+
 struct click_history {
 	uint64_t last_press;
 	uint64_t last_release;
@@ -665,6 +670,44 @@ void do_clickevent(mousebutton_t button, pressrel_t pr)
 	CFRelease(ev);
 }
 
+/* CG's default scroll-line height, for converting wheel clicks to pixels */
+#define SCROLL_PIXELS_PER_LINE 10.0
+
+/*
+ * Scroll events are posted as continuous (trackpad-style) pixel-unit
+ * events, so fractional amounts scroll smoothly instead of being rounded
+ * to whole lines.  The integer pixel deltas carry any sub-pixel remainder
+ * over to the next call; the fixed-point line deltas get the exact
+ * values.  (Note that CG's scroll deltas are positive for up/left, the
+ * opposite of ours.)
+ */
+void do_scroll(float dx, float dy)
+{
+	static double remainder_x, remainder_y;
+	int32_t pixels_x, pixels_y;
+	CGEventRef ev;
+
+	remainder_x += dx * SCROLL_PIXELS_PER_LINE;
+	remainder_y += dy * SCROLL_PIXELS_PER_LINE;
+	pixels_x = trunc(remainder_x);
+	pixels_y = trunc(remainder_y);
+	remainder_x -= pixels_x;
+	remainder_y -= pixels_y;
+
+	ev = CGEventCreateScrollWheelEvent(NULL, kCGScrollEventUnitPixel, 2,
+	                                   -pixels_y, -pixels_x);
+	if (!ev) {
+		errlog("CGEventCreateScrollWheelEvent failed\n");
+		abort();
+	}
+	CGEventSetIntegerValueField(ev, kCGScrollWheelEventIsContinuous, 1);
+	CGEventSetDoubleValueField(ev, kCGScrollWheelEventFixedPtDeltaAxis1, -dy);
+	CGEventSetDoubleValueField(ev, kCGScrollWheelEventFixedPtDeltaAxis2, -dx);
+	CGEventSetFlags(ev, modflags|kCGEventFlagMaskNonCoalesced);
+	CGEventPost(kCGHIDEventTap, ev);
+	CFRelease(ev);
+}
+
 static CGEventFlags key_eventflag(CGKeyCode cgk)
 {
 	switch (cgk) {
@@ -732,7 +775,7 @@ void do_keyevent(keycode_t key, pressrel_t pr)
 	CFRelease(ev);
 }
 
-char* get_clipboard_text(void)
+static char* read_clipboard_text(void)
 {
 	OSStatus status;
 	PasteboardItemID itemid;
@@ -770,13 +813,19 @@ char* get_clipboard_text(void)
 	return txt;
 }
 
-int set_clipboard_text(const char* text)
+/* The pasteboard is read synchronously, so this completes immediately. */
+void get_clipboard_text(clipboard_text_callback_t cb, void* arg)
+{
+	cb(new_clipbuf(read_clipboard_text()), arg);
+}
+
+int set_clipboard_text(struct clipbuf* text)
 {
 	OSStatus status;
 	CFDataRef data;
 	int ret = 0;
 
-	data = CFDataCreate(NULL, (UInt8*)text, strlen(text));
+	data = CFDataCreate(NULL, (UInt8*)text->text, text->len);
 	if (!data) {
 		errlog("CFDataCreate() failed\n");
 		return -1;
@@ -802,6 +851,20 @@ int set_clipboard_text(const char* text)
 	return ret;
 }
 
+/*
+ * Pasteboard promises are kept synchronously, so there's no way to wait for
+ * the data to arrive from elsewhere; lazy claims are thus unsupported.
+ */
+int set_clipboard_lazy(clipboard_fetch_fn_t fetch, void* arg)
+{
+	return -1;
+}
+
+int clipboard_is_lazy(void)
+{
+	return 0;
+}
+
 static struct xypoint saved_mousepos;
 
 int grab_inputs(void)
@@ -1139,18 +1202,16 @@ static void handle_local_mousemove(CGEventRef ev)
  */
 static void handle_scrollevent(CGEventRef ev)
 {
-	mousebutton_t mb;
-	double scroll_units;
+	double dy, dx;
 
-	scroll_units = CGEventGetDoubleValueField(ev, kCGScrollWheelEventFixedPtDeltaAxis1);
+	/* Fractional line counts, positive for up (axis 1) and left (axis 2) */
+	dy = CGEventGetDoubleValueField(ev, kCGScrollWheelEventFixedPtDeltaAxis1);
+	dx = CGEventGetDoubleValueField(ev, kCGScrollWheelEventFixedPtDeltaAxis2);
 
-	if (fabs(scroll_units) < 0.0001)
+	if (fabs(dy) < 0.0001 && fabs(dx) < 0.0001)
 		return;
 
-	mb = scroll_units < 0.0 ? MB_SCROLLDOWN : MB_SCROLLUP;
-
-	send_clickevent(focused_node->remote, mb, PR_PRESS);
-	send_clickevent(focused_node->remote, mb, PR_RELEASE);
+	send_scroll(focused_node->remote, -dx, -dy);
 }
 
 static CFMachPortRef evtapport;
@@ -14,6 +14,21 @@ void move_mousepos(int32_t dx, int32_t dy);
 void do_clickevent(mousebutton_t button, pressrel_t pr);
 void do_keyevent(keycode_t key, pressrel_t pr);
 
+/*
+ * Scroll by the given (possibly fractional) numbers of wheel clicks;
+ * positive values scroll right and down.
+ */
+void do_scroll(float dx, float dy);
+
+/*
+ * set_mousepos(), move_mousepos(), do_clickevent(), do_keyevent() and
+ * do_scroll() may just buffer the events they generate; this sends out
+ * anything so buffered.  Callers should call it once they're done with a
+ * batch of them (e.g. everything received from the master in one go), and
+ * before doing anything that could take a while.
+ */
+void flush_input_events(void);
+
 /* An opaque, platform-dependent "context" type associated with a hotkey event. */
 typedef const struct hotkey_context* hotkey_context_t;
 typedef void (*hotkey_callback_t)(hotkey_context_t ctx, void* arg);
@@ -25,8 +40,34 @@ keycode_t* get_current_modifiers(void);
 int grab_inputs(void);
 void ungrab_inputs(int restore_mousepos);
 
-char* get_clipboard_text(void);
-int set_clipboard_text(const char* text);
+/*
+ * Retrieve the current clipboard contents, passing them to 'cb' as a clipbuf
+ * reference that's then the callback's to drop.  This may happen before
+ * get_clipboard_text() returns or later from the event loop, depending on
+ * where the data has to come from.
+ */
+typedef void (*clipboard_text_callback_t)(struct clipbuf* text, void* arg);
+void get_clipboard_text(clipboard_text_callback_t cb, void* arg);
+
+/*
+ * Set the clipboard contents.  The platform code takes its own reference to
+ * 'text' if it holds on to it, so the caller's remains the caller's.
+ */
+int set_clipboard_text(struct clipbuf* text);
+
+/*
+ * Take ownership of the clipboard without supplying its contents.  If and
+ * when something asks for them, 'fetch' is called (with 'arg') and should
+ * arrange for set_clipboard_text() to be called with them, completing any
+ * pastes waiting in the meantime.  Returns negative if the clipboard can't
+ * be claimed this way, in which case the caller should supply the contents
+ * up front instead.
+ */
+typedef void (*clipboard_fetch_fn_t)(void* arg);
+int set_clipboard_lazy(clipboard_fetch_fn_t fetch, void* arg);
+
+/* Whether we hold a lazy claim on the clipboard that's yet to be filled. */
+int clipboard_is_lazy(void);
 
 void set_display_brightness(float f);
 
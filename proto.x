@@ -32,7 +32,16 @@ enum msgtype_t {
 	MT_SETCLIPBOARD,
 	MT_LOGMSG,
 	MT_SETBRIGHTNESS,
-	MT_SETLOGLEVEL
+	MT_SETLOGLEVEL,
+	MT_EDGEEVENT,
+	MT_CLIPBEGIN,
+	MT_CLIPCHUNK,
+	MT_CLIPEND,
+	MT_GETCLIPHASH,
+	MT_CLIPHASH,
+	MT_CLIPOFFER,
+	MT_CLIPZBEGIN,
+	MT_SCROLL
 };
 
 /* Screen position (e.g. for the mouse pointer), with 0,0 at the top left. */
@@ -62,7 +71,8 @@ struct kvpair {
  * SETUP: the first message sent by the master to each remote upon
  * establishing a connection.  Contains various initialization parameters,
  * including log level and an unstructured kvmap of miscellaneous other things
- * (like the DISPLAY environment variable for X11 remotes).
+ * (like the DISPLAY environment variable for X11 remotes).  Also carries
+ * the master's protocol capabilities (see message.c).
  *
  * Should trigger a READY in reply.
  */
@@ -75,7 +85,7 @@ struct setup_body {
 /*
  * READY: the first message sent by a newly-alive remote in response to
  * receiving a SETUP from the master.  Informs the master of the remote's
- * display dimensions.
+ * display dimensions and (like SETUP) its protocol capabilities.
  *
  * No reply expected.
  */
@@ -106,7 +116,8 @@ struct moveabs_body {
 
 /*
  * MOUSEPOS: sent by remotes to the master in response to a MOVEREL to inform
- * the master of the mouse pointer's new position (post-MOVEREL).
+ * the master of the mouse pointer's new position (post-MOVEREL).  Not sent
+ * if PROT_CAP_EDGEEVENT has been negotiated (see EDGEEVENT).
  *
  * No reply expected.
  */
@@ -136,7 +147,9 @@ struct keyevent_body {
 
 /*
  * GETCLIPBOARD: sent by the master to a remote to retrieve the contents of
- * the remote's clipboard.
+ * the remote's clipboard, or (if PROT_CAP_CLIPLAZY has been negotiated) by a
+ * remote to the master to retrieve contents previously offered in a
+ * CLIPOFFER.
  *
  * Should trigger a SETCLIPBOARD in reply.
  *
@@ -186,6 +199,102 @@ struct setloglevel_body {
 	uint32_t loglevel;
 };
 
+/*
+ * EDGEEVENT: sent by remotes to the master (in place of MOUSEPOS, if
+ * PROT_CAP_EDGEEVENT has been negotiated) when a MOVEREL causes the mouse
+ * pointer to arrive at or depart from a screen edge.  'dir' is a direction_t,
+ * 'evtype' an edgeevent_t, and 'pos' the pointer's position along that edge
+ * as a fraction of its length.  One is sent for each edge whose state
+ * changed.
+ *
+ * No reply expected.
+ */
+struct edgeevent_body {
+	uint32_t dir;
+	uint32_t evtype;
+	float pos;
+};
+
+/*
+ * CLIPBEGIN, CLIPCHUNK, CLIPEND: used in place of a single SETCLIPBOARD (if
+ * PROT_CAP_CLIPCHUNKS has been negotiated) to send clipboard contents in
+ * bounded-size pieces, so that other messages can be interleaved with them
+ * instead of waiting behind one large one.  A CLIPBEGIN announces transfer
+ * 'id' and its total length, the data follows in order in CLIPCHUNKs, and a
+ * CLIPEND completes it, at which point the recipient handles it exactly as
+ * it would the equivalent SETCLIPBOARD.  A CLIPBEGIN abandons any incomplete
+ * transfer that preceded it.
+ *
+ * CLIPZBEGIN (if PROT_CAP_CLIPZLIB has also been negotiated) is the same as
+ * CLIPBEGIN, except that the data carried by the transfer's CLIPCHUNKs is a
+ * zlib stream that inflates to the 'len' bytes of clipboard text.
+ *
+ * No reply expected.
+ */
+struct clipbegin_body {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct clipchunk_body {
+	uint32_t id;
+	opaque data<>;
+};
+
+struct clipend_body {
+	uint32_t id;
+};
+
+/*
+ * GETCLIPHASH: sent by the master to a remote (if PROT_CAP_CLIPHASH has been
+ * negotiated) in place of a GETCLIPBOARD, to find out whether the remote's
+ * clipboard contents differ from what the master already has before
+ * transferring them.
+ *
+ * Should trigger a CLIPHASH in reply.
+ *
+ * GETCLIPHASH messages have no body content.
+ */
+
+/*
+ * CLIPHASH: sent by a remote to the master in response to a GETCLIPHASH,
+ * carrying the hash (see clipboard_hash()) of the remote's clipboard
+ * contents.  If it doesn't match the master's, the master will follow up
+ * with a GETCLIPBOARD.
+ *
+ * No reply expected.
+ */
+struct cliphash_body {
+	unsigned hyper hash;
+};
+
+/*
+ * CLIPOFFER: sent by the master to a remote (if PROT_CAP_CLIPLAZY has been
+ * negotiated and lazy clipboard transfers are enabled) in place of a
+ * SETCLIPBOARD, announcing clipboard contents with the given hash without
+ * sending them.  The remote claims its clipboard and sends a GETCLIPBOARD
+ * to retrieve the contents only if and when something there asks for them.
+ *
+ * No reply expected.
+ */
+struct clipoffer_body {
+	unsigned hyper hash;
+};
+
+/*
+ * SCROLL: sent by the master to a remote (if PROT_CAP_SCROLL has been
+ * negotiated) in place of scroll-wheel CLICKEVENTs.  'dx' and 'dy' are the
+ * horizontal and vertical amounts to scroll, in (possibly fractional) wheel
+ * notches, with the remote's scroll-multiplier already applied; positive
+ * values scroll right and down.
+ *
+ * No reply expected.
+ */
+struct scroll_body {
+	float dx;
+	float dy;
+};
+
 union msgbody switch (msgtype_t type) {
 case MT_SETUP:
 	setup_body setup;
@@ -211,4 +320,22 @@ case MT_SETBRIGHTNESS:
 	setbrightness_body setbrightness;
 case MT_SETLOGLEVEL:
 	setloglevel_body setloglevel;
+case MT_EDGEEVENT:
+	edgeevent_body edgeevent;
+case MT_CLIPBEGIN:
+	clipbegin_body clipbegin;
+case MT_CLIPCHUNK:
+	clipchunk_body clipchunk;
+case MT_CLIPEND:
+	clipend_body clipend;
+case MT_GETCLIPHASH:
+	void;
+case MT_CLIPHASH:
+	cliphash_body cliphash;
+case MT_CLIPOFFER:
+	clipoffer_body clipoffer;
+case MT_CLIPZBEGIN:
+	clipbegin_body clipzbegin;
+case MT_SCROLL:
+	scroll_body scroll;
 };
@@ -11,8 +11,22 @@ struct msgchan stdio_msgchan;
 
 static int initialized = 0;
 
+/* Pending scheduled call to flush_input_events(), if any */
+static timer_ctx_t input_flush;
+
+/* Hash of the clipboard contents most recently offered by the master */
+static uint64_t offered_cliphash;
+
+/*
+ * Screen dimensions and current edge-contact state, for detecting edge
+ * events locally when the master supports PROT_CAP_EDGEEVENT.
+ */
+static struct rectangle screendim;
+static dirmask_t edgemask;
+
 static void shutdown_remote(void)
 {
+	drain_msgpool();
 	mc_close(&stdio_msgchan);
 
 	if (initialized)
@@ -28,39 +42,141 @@ static void enqueue_message(struct message* msg)
 	}
 }
 
-static void handle_message(const struct message* msg)
+/*
+ * Report the pointer's position after a relative move.  If the master
+ * understands EDGEEVENT messages we do the edge detection here and only send
+ * something when the pointer arrives at or departs from a screen edge;
+ * otherwise we fall back to sending a MOUSEPOS reply for every move.
+ */
+static void report_mousepos(void)
+{
+	struct message* msg;
+	struct xypoint pt = get_mousepos();
+	direction_t dir;
+	dirmask_t newmask, dirmask;
+
+	if (!(stdio_msgchan.features & PROT_CAP_EDGEEVENT)) {
+		msg = new_message(MT_MOUSEPOS);
+		MB(msg, mousepos).pt = pt;
+		enqueue_message(msg);
+		return;
+	}
+
+	newmask = point_edgemask(pt, &screendim);
+	if (newmask == edgemask)
+		return;
+
+	for_each_direction (dir) {
+		dirmask = 1U << dir;
+		if ((edgemask & dirmask) == (newmask & dirmask))
+			continue;
+		msg = new_message(MT_EDGEEVENT);
+		MB(msg, edgeevent).dir = dir;
+		MB(msg, edgeevent).evtype = (newmask & dirmask) ? EE_ARRIVE : EE_DEPART;
+		MB(msg, edgeevent).pos = edge_position(dir, pt, &screendim);
+		enqueue_message(msg);
+	}
+
+	edgemask = newmask;
+}
+
+static void flush_input_cb(void* arg)
+{
+	input_flush = NULL;
+	flush_input_events();
+}
+
+/*
+ * Arrange for the input events we've just injected to be flushed out once
+ * everything else received in this event-loop iteration (typically a whole
+ * batch of input from the master) has been handled, rather than doing so
+ * after each one.
+ */
+static void input_injected(void)
+{
+	if (!input_flush)
+		input_flush = schedule_call(flush_input_cb, NULL, NULL, 0);
+}
+
+static void send_clipboard_cb(struct clipbuf* text, void* arg)
+{
+	struct message* msg = new_message(MT_SETCLIPBOARD);
+
+	msg->clip = text;
+	MB(msg, setclipboard).text = text->text;
+	enqueue_message(msg);
+}
+
+static void send_cliphash(uint64_t hash)
+{
+	struct message* msg = new_message(MT_CLIPHASH);
+
+	MB(msg, cliphash).hash = hash;
+	enqueue_message(msg);
+}
+
+static void send_cliphash_cb(struct clipbuf* text, void* arg)
+{
+	send_cliphash(clipbuf_hash(text));
+	clipbuf_put(text);
+}
+
+/* set_clipboard_lazy() callback: ask the master for what it offered. */
+static void request_clipboard(void* arg)
 {
-	struct message* resp;
+	enqueue_message(new_message(MT_GETCLIPBOARD));
+}
 
+static void handle_message(const struct message* msg)
+{
 	switch (msg->body.type) {
 	case MT_MOVEREL:
 		move_mousepos(MB(msg, moverel).dx, MB(msg, moverel).dy);
-		resp = new_message(MT_MOUSEPOS);
-		MB(resp, mousepos).pt = get_mousepos();
-		enqueue_message(resp);
+		input_injected();
+		report_mousepos();
 		break;
 
 	case MT_MOVEABS:
 		set_mousepos(MB(msg, moveabs).pt);
+		input_injected();
 		break;
 
 	case MT_CLICKEVENT:
 		do_clickevent(MB(msg, clickevent).button,
 		              MB(msg, clickevent).pressrel);
+		input_injected();
 		break;
 
 	case MT_KEYEVENT:
 		do_keyevent(MB(msg, keyevent).keycode, MB(msg, keyevent).pressrel);
+		input_injected();
+		break;
+
+	case MT_SCROLL:
+		do_scroll(MB(msg, scroll).dx, MB(msg, scroll).dy);
+		input_injected();
 		break;
 
 	case MT_GETCLIPBOARD:
-		resp = new_message(MT_SETCLIPBOARD);
-		MB(resp, setclipboard).text = get_clipboard_text();
-		enqueue_message(resp);
+		get_clipboard_text(send_clipboard_cb, NULL);
+		break;
+
+	case MT_GETCLIPHASH:
+		/* Don't go fetching offered contents just to hash them */
+		if (clipboard_is_lazy())
+			send_cliphash(offered_cliphash);
+		else
+			get_clipboard_text(send_cliphash_cb, NULL);
+		break;
+
+	case MT_CLIPOFFER:
+		offered_cliphash = MB(msg, clipoffer).hash;
+		if (set_clipboard_lazy(request_clipboard, NULL))
+			request_clipboard(NULL);
 		break;
 
 	case MT_SETCLIPBOARD:
-		set_clipboard_text(MB(msg, setclipboard).text);
+		set_clipboard_text(msg->clip);
 		break;
 
 	case MT_SETBRIGHTNESS:
@@ -83,6 +199,7 @@ static void handle_setup_msg(const struct message* msg)
 {
 	struct message* readymsg;
 	struct kvmap* params;
+	char* features;
 
 	if (msg->body.type != MT_SETUP) {
 		errlog("unexpected message type %u instead of SETUP\n", msg->body.type);
@@ -111,8 +228,15 @@ static void handle_setup_msg(const struct message* msg)
 	destroy_kvmap(params);
 
 	readymsg = new_message(MT_READY);
-	get_screen_dimensions(&MB(readymsg, ready).screendim);
+	get_screen_dimensions(&screendim);
+	MB(readymsg, ready).screendim = screendim;
+	readymsg->caps = PROT_CAPS_SUPPORTED;
 	enqueue_message(readymsg);
+
+	stdio_msgchan.features = msg->caps & PROT_CAPS_SUPPORTED;
+	features = prot_caps_str(stdio_msgchan.features);
+	debug("protocol features: %s\n", features);
+	xfree(features);
 }
 
 /* msgchan callback to handle received messages */
@@ -85,6 +85,25 @@ struct edge_state {
 	unsigned int evidx;
 };
 
+/*
+ * Reference-counted clipboard contents, so that the same (possibly very
+ * large) text can be held by the platform clipboard code, a received
+ * message, and any number of outgoing transfers without being copied for
+ * each.  The text must not be modified once shared, and is wiped when the
+ * last reference is dropped (see clipbuf_put()).
+ */
+struct clipbuf {
+	char* text;
+	size_t len;
+	unsigned int refcount;
+
+	/* clipboard_hash() of the text, computed on demand (zero until then) */
+	uint64_t hash;
+
+	/* Compressed form of the text, set up on demand (NULL until then) */
+	struct clipzbuf* z;
+};
+
 #include "msgchan.h"
 #include "message.h"
 #include "kvmap.h"
@@ -140,6 +159,26 @@ struct remote {
 	/* multiplier for scroll-wheel events (some systems scroll "slower" than others) */
 	int scrollmult;
 
+	/*
+	 * Fractional vertical scrolling not yet sent, if the remote doesn't
+	 * support PROT_CAP_SCROLL and so only gets whole wheel clicks.
+	 */
+	float scroll_remainder;
+
+	/*
+	 * Protocol capabilities (PROT_CAP_*) to offer this remote; the
+	 * negotiated subset in use is in msgchan.features.
+	 */
+	uint32_t prot_caps;
+
+	/*
+	 * Hash (see clipboard_hash()) of the clipboard contents last sent to
+	 * or received from this remote, or zero if unknown.  Used to skip
+	 * sending it what it already has; this does assume nothing on the
+	 * remote changes its clipboard while it doesn't have focus.
+	 */
+	uint64_t cliphash;
+
 	/* msgchan by which the master exchanges messages with this remote */
 	struct msgchan msgchan;
 
@@ -167,16 +206,45 @@ struct noderef {
 	};
 };
 
+/* A member of a group (see below) */
+struct group_member {
+	struct noderef nr;
+
+	/* Set if dropped from the group for falling behind on input */
+	int dropped;
+
+	struct group_member* next;
+};
+
+/*
+ * A named set of remotes that keyboard and mouse-button input can be
+ * directed to all at once (via a 'focus group' hotkey action).
+ */
+struct group {
+	char* name;
+	struct group_member* members;
+
+	/* for linking into a list of groups */
+	struct group* next;
+};
+
 /* Things that can go in a 'focus' hotkey action. */
 struct focus_target {
 	enum {
 		FT_DIRECTION,
 		FT_NODE,
 		FT_PREVIOUS,
+		FT_GROUP,
 	} type;
 	union {
 		direction_t dir;
 		struct noderef nr;
+
+		/* Group name, resolved to the group itself during setup */
+		struct {
+			char* name;
+			struct group* group;
+		} grp;
 	};
 };
 
@@ -257,6 +325,7 @@ struct config {
 	struct remote* remotes;
 	struct link* topology;
 	struct hotkey* hotkeys;
+	struct group* groups;
 
 	struct {
 		struct logfile file;
@@ -281,6 +350,12 @@ struct config {
 	struct ssh_config ssh_defaults;
 	int use_private_ssh_agent;
 
+	/* whether to transfer clipboard contents only when pasted */
+	int lazy_clipboard;
+
+	/* size limit for batches of messages sent to remotes (0 disables) */
+	unsigned int batch_size;
+
 	struct node master;
 };
 
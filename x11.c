@@ -5,6 +5,14 @@
 #include <limits.h>
 #include <math.h>
 
+/* Use epoll for the event loop where available, select() otherwise. */
+#if defined(__linux__) && !defined(NO_EPOLL)
+#define USE_EPOLL
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/keysym.h>
@@ -28,6 +36,7 @@ static Cursor xcursor_blank;
 static Atom et_selection_data;
 static Atom utf8_string_atom;
 static Atom targets_atom;
+static Atom incr_atom;
 
 static Time last_xevent_time;
 
@@ -56,19 +65,468 @@ static struct {
 	{ "CLIPBOARD", None, }, /* filled in in platform_init() */
 };
 
-static char* clipboard_text;
+static struct clipbuf* clipboard_text;
 static Time xselection_owned_since;
 
-/* Clipboard contents are potentially sensitive, so wipe before freeing. */
+/* Drop our reference to the clipboard contents (wiped once unused). */
 static void clear_clipboard_cache(void)
 {
 	if (clipboard_text)
-		explicit_bzero(clipboard_text, strlen(clipboard_text));
-	xfree(clipboard_text);
+		clipbuf_put(clipboard_text);
 	clipboard_text = NULL;
 	xselection_owned_since = 0;
 }
 
+/* The longest we'll wait for a SelectionNotify event before giving up */
+#define SELECTION_TIMEOUT_US 100000
+
+/* ...and for each step of an INCR transfer (in either direction) */
+#define INCR_TIMEOUT_US 5000000
+
+/* ...and for the contents of a lazily-claimed selection to be supplied */
+#define LAZY_FETCH_TIMEOUT_US 5000000
+
+/*
+ * Selection data larger than this is transferred in pieces via the ICCCM
+ * INCR mechanism instead of in a single property change; set in
+ * platform_init() based on the server's maximum request size.
+ */
+static size_t selection_chunk_size;
+
+/*
+ * Clipboard data accumulated from (possibly several) window properties.
+ * Grown by hand rather than with realloc() so that old copies can be wiped.
+ */
+struct selbuf {
+	char* data;
+	size_t len, size;
+};
+
+static void selbuf_append(struct selbuf* sb, const void* data, size_t len)
+{
+	char* newdata;
+	size_t newsize;
+
+	if (sb->len + len + 1 > sb->size) {
+		newsize = sb->size ? sb->size : 4096;
+		while (newsize < sb->len + len + 1)
+			newsize *= 2;
+		newdata = xmalloc(newsize);
+		if (sb->data) {
+			memcpy(newdata, sb->data, sb->len);
+			explicit_bzero(sb->data, sb->len);
+			xfree(sb->data);
+		}
+		sb->data = newdata;
+		sb->size = newsize;
+	}
+
+	memcpy(sb->data + sb->len, data, len);
+	sb->len += len;
+	sb->data[sb->len] = '\0';
+}
+
+/* Take the accumulated text as a new clipbuf, leaving 'sb' empty. */
+static struct clipbuf* selbuf_take(struct selbuf* sb)
+{
+	char* text = sb->data ? sb->data : xstrdup("");
+
+	sb->data = NULL;
+	sb->len = sb->size = 0;
+
+	return new_clipbuf(text);
+}
+
+static void selbuf_clear(struct selbuf* sb)
+{
+	if (sb->data)
+		explicit_bzero(sb->data, sb->len);
+	xfree(sb->data);
+	sb->data = NULL;
+	sb->len = sb->size = 0;
+}
+
+/*
+ * State of an in-progress asynchronous fetch of the X selection.  Requests
+ * that arrive while one is already outstanding just join its list of
+ * waiters rather than issuing another XConvertSelection.
+ */
+struct clipboard_waiter {
+	clipboard_text_callback_t cb;
+	void* arg;
+	struct clipboard_waiter* next;
+};
+
+static struct {
+	struct clipboard_waiter* waiters;
+	struct clipboard_waiter** tail;
+	timer_ctx_t timeout;
+
+	/* Set while receiving the data via INCR */
+	int incr;
+	struct selbuf buf;
+} selection_fetch = {
+	.waiters = NULL,
+	.tail = &selection_fetch.waiters,
+};
+
+/* Hand 'text' to everything waiting on the current selection fetch. */
+static void finish_selection_fetch(struct clipbuf* text)
+{
+	struct clipboard_waiter* w;
+	struct clipboard_waiter* waiters = selection_fetch.waiters;
+
+	if (selection_fetch.timeout) {
+		cancel_call(selection_fetch.timeout);
+		selection_fetch.timeout = NULL;
+	}
+
+	selection_fetch.incr = 0;
+	selbuf_clear(&selection_fetch.buf);
+
+	/*
+	 * Detach the list first so that callbacks can start a new fetch if
+	 * they want to.
+	 */
+	selection_fetch.waiters = NULL;
+	selection_fetch.tail = &selection_fetch.waiters;
+
+	while (waiters) {
+		w = waiters;
+		waiters = w->next;
+		w->cb(waiters ? clipbuf_get(text) : text, w->arg);
+		xfree(w);
+	}
+}
+
+static void selection_timeout_cb(void* arg)
+{
+	selection_fetch.timeout = NULL;
+	errlog("timed out waiting for selection\n");
+	finish_selection_fetch(new_clipbuf(xstrdup("")));
+}
+
+static void set_selection_timeout(uint64_t delay)
+{
+	if (selection_fetch.timeout)
+		cancel_call(selection_fetch.timeout);
+	selection_fetch.timeout = schedule_call(selection_timeout_cb, NULL, NULL, delay);
+}
+
+/* Drop any outstanding selection-fetch requests without completing them. */
+static void abort_selection_fetch(void)
+{
+	struct clipboard_waiter* w;
+
+	while (selection_fetch.waiters) {
+		w = selection_fetch.waiters;
+		selection_fetch.waiters = w->next;
+		xfree(w);
+	}
+	selection_fetch.tail = &selection_fetch.waiters;
+
+	if (selection_fetch.timeout) {
+		cancel_call(selection_fetch.timeout);
+		selection_fetch.timeout = NULL;
+	}
+
+	selection_fetch.incr = 0;
+	selbuf_clear(&selection_fetch.buf);
+}
+
+/*
+ * Other clients' windows can go away at any time, so errors from operations
+ * on them (during INCR transfers) are trapped instead of being fatal.
+ */
+static int trapped_xerr;
+static int (*untrapped_xerr_handler)(Display*, XErrorEvent*);
+
+static int xerr_trap(Display* d, XErrorEvent* xev)
+{
+	if (!trapped_xerr)
+		trapped_xerr = xev->error_code;
+	return 0;
+}
+
+static void trap_xerrs(void)
+{
+	XSync(xdisp, False);
+	trapped_xerr = 0;
+	untrapped_xerr_handler = XSetErrorHandler(xerr_trap);
+}
+
+static int untrap_xerrs(void)
+{
+	XSync(xdisp, False);
+	XSetErrorHandler(untrapped_xerr_handler);
+	return trapped_xerr;
+}
+
+/*
+ * An outgoing INCR transfer (ICCCM sec. 2.7.2) of selection data too large
+ * to send in a single property change.  The requestor deletes the property
+ * each time it's consumed a chunk, at which point we send the next one.
+ */
+struct incr_transfer {
+	Window requestor;
+	Atom property;
+	Atom target;
+
+	/* Our own reference to the data, in case the selection changes mid-transfer */
+	struct clipbuf* clip;
+	size_t sent;
+
+	timer_ctx_t timeout;
+	struct incr_transfer* next;
+};
+
+static struct incr_transfer* incr_transfers;
+
+static void free_incr_transfer(struct incr_transfer* xfer)
+{
+	struct incr_transfer* t;
+	struct incr_transfer** prevnext;
+
+	for (prevnext = &incr_transfers; *prevnext != xfer; prevnext = &(*prevnext)->next)
+		;
+	*prevnext = xfer->next;
+
+	if (xfer->timeout)
+		cancel_call(xfer->timeout);
+
+	/* Stop watching the requestor's properties unless we've got other transfers to it */
+	for (t = incr_transfers; t; t = t->next) {
+		if (t->requestor == xfer->requestor)
+			break;
+	}
+	if (!t && xfer->requestor != xwin) {
+		trap_xerrs();
+		XSelectInput(xdisp, xfer->requestor, NoEventMask);
+		untrap_xerrs();
+	}
+
+	clipbuf_put(xfer->clip);
+	xfree(xfer);
+}
+
+static void incr_timeout_cb(void* arg)
+{
+	struct incr_transfer* xfer = arg;
+
+	xfer->timeout = NULL;
+	warn("INCR selection transfer to 0x%lx timed out\n", xfer->requestor);
+	free_incr_transfer(xfer);
+}
+
+/* Begin an INCR transfer of the clipboard text in response to 'req'. */
+static int start_incr_transfer(const XSelectionRequestEvent* req, Atom property)
+{
+	long len = clipboard_text->len;
+	struct incr_transfer* xfer;
+
+	trap_xerrs();
+	XSelectInput(xdisp, req->requestor, PropertyChangeMask);
+	XChangeProperty(xdisp, req->requestor, property, incr_atom, 32,
+	                PropModeReplace, (unsigned char*)&len, 1);
+	if (untrap_xerrs()) {
+		warn("failed to start INCR selection transfer to 0x%lx\n",
+		     req->requestor);
+		return -1;
+	}
+
+	xfer = xmalloc(sizeof(*xfer));
+	xfer->requestor = req->requestor;
+	xfer->property = property;
+	xfer->target = req->target;
+	xfer->clip = clipbuf_get(clipboard_text);
+	xfer->sent = 0;
+	xfer->timeout = schedule_call(incr_timeout_cb, xfer, NULL, INCR_TIMEOUT_US);
+
+	xfer->next = incr_transfers;
+	incr_transfers = xfer;
+
+	return 0;
+}
+
+static void send_incr_chunk(struct incr_transfer* xfer)
+{
+	size_t len = xfer->clip->len - xfer->sent;
+
+	if (len > selection_chunk_size)
+		len = selection_chunk_size;
+
+	trap_xerrs();
+	XChangeProperty(xdisp, xfer->requestor, xfer->property, xfer->target, 8,
+	                PropModeReplace, (unsigned char*)xfer->clip->text + xfer->sent, len);
+	if (untrap_xerrs()) {
+		warn("INCR selection transfer to 0x%lx failed\n", xfer->requestor);
+		free_incr_transfer(xfer);
+		return;
+	}
+
+	/* The final, zero-length chunk marks the end of the transfer */
+	if (!len) {
+		free_incr_transfer(xfer);
+		return;
+	}
+
+	xfer->sent += len;
+
+	cancel_call(xfer->timeout);
+	xfer->timeout = schedule_call(incr_timeout_cb, xfer, NULL, INCR_TIMEOUT_US);
+}
+
+static Status send_selection_notify(const XSelectionRequestEvent* req, Atom property)
+{
+	XEvent ev;
+	XSelectionEvent* resp = &ev.xselection;
+
+	resp->type = SelectionNotify;
+	resp->display = req->display;
+	resp->requestor = req->requestor;
+	resp->selection = req->selection;
+	resp->target = req->target;
+	resp->property = property;
+	resp->time = req->time;
+
+	return XSendEvent(xdisp, req->requestor, False, 0, &ev);
+}
+
+/*
+ * Store the clipboard text (which we must have) in the given property of a
+ * SelectionRequest's requestor, returning the property to report in the
+ * SelectionNotify (None on failure).
+ */
+static Atom send_selection_text(const XSelectionRequestEvent* req, Atom property)
+{
+	size_t len = clipboard_text->len;
+
+	if (len > selection_chunk_size)
+		return start_incr_transfer(req, property) ? None : property;
+
+	XChangeProperty(xdisp, req->requestor, property, req->target, 8,
+	                PropModeReplace, (unsigned char*)clipboard_text->text, len);
+	return property;
+}
+
+/*
+ * A SelectionRequest for lazily-claimed selection contents that haven't
+ * arrived yet.
+ */
+struct lazy_selreq {
+	XSelectionRequestEvent req;
+	struct lazy_selreq* next;
+};
+
+/*
+ * State of a lazy claim on the selection (see set_clipboard_lazy()): the
+ * function to call to obtain its contents, and the SelectionRequests and
+ * get_clipboard_text() callers waiting for them.  'timeout' is set while a
+ * fetch is in progress.
+ */
+static struct {
+	clipboard_fetch_fn_t fetch;
+	void* arg;
+	struct lazy_selreq* reqs;
+	struct clipboard_waiter* waiters;
+	timer_ctx_t timeout;
+} lazy_selection;
+
+/*
+ * Complete everything waiting on a lazy fetch, with the clipboard text if
+ * 'ok' and with nothing (or an empty string) otherwise.
+ */
+static void finish_lazy_fetch(int ok)
+{
+	Atom property;
+	struct lazy_selreq* r;
+	struct clipboard_waiter* w;
+	struct lazy_selreq* reqs = lazy_selection.reqs;
+	struct clipboard_waiter* waiters = lazy_selection.waiters;
+
+	if (lazy_selection.timeout) {
+		cancel_call(lazy_selection.timeout);
+		lazy_selection.timeout = NULL;
+	}
+
+	lazy_selection.reqs = NULL;
+	lazy_selection.waiters = NULL;
+
+	while (reqs) {
+		r = reqs;
+		reqs = r->next;
+		property = (r->req.property == None) ? r->req.target : r->req.property;
+		if (ok)
+			property = send_selection_text(&r->req, property);
+		else
+			property = None;
+		if (!send_selection_notify(&r->req, property))
+			errlog("Failed to send SelectionNotify to requestor\n");
+		xfree(r);
+	}
+
+	while (waiters) {
+		w = waiters;
+		waiters = w->next;
+		w->cb(ok ? clipbuf_get(clipboard_text) : new_clipbuf(xstrdup("")), w->arg);
+		xfree(w);
+	}
+}
+
+static void lazy_fetch_timeout_cb(void* arg)
+{
+	lazy_selection.timeout = NULL;
+	warn("timed out waiting for lazily-claimed selection contents\n");
+	finish_lazy_fetch(0);
+}
+
+/*
+ * Ask for the contents of a lazily-claimed selection, unless we've already
+ * done so.  (They may well be supplied before this returns.)
+ */
+static void start_lazy_fetch(void)
+{
+	if (lazy_selection.timeout)
+		return;
+
+	lazy_selection.timeout = schedule_call(lazy_fetch_timeout_cb, NULL, NULL,
+	                                       LAZY_FETCH_TIMEOUT_US);
+	lazy_selection.fetch(lazy_selection.arg);
+}
+
+/* Give up a lazy claim on the selection, failing anything waiting on it. */
+static void drop_lazy_selection(void)
+{
+	lazy_selection.fetch = NULL;
+	finish_lazy_fetch(0);
+}
+
+/* Like drop_lazy_selection(), but without replying to anyone (for exit). */
+static void abort_lazy_selection(void)
+{
+	struct lazy_selreq* r;
+	struct clipboard_waiter* w;
+
+	lazy_selection.fetch = NULL;
+
+	if (lazy_selection.timeout) {
+		cancel_call(lazy_selection.timeout);
+		lazy_selection.timeout = NULL;
+	}
+
+	while (lazy_selection.reqs) {
+		r = lazy_selection.reqs;
+		lazy_selection.reqs = r->next;
+		xfree(r);
+	}
+
+	while (lazy_selection.waiters) {
+		w = lazy_selection.waiters;
+		lazy_selection.waiters = w->next;
+		xfree(w);
+	}
+}
+
 /* Mask combining currently-applied modifiers and mouse buttons */
 static unsigned int xstate;
 
@@ -82,21 +540,226 @@ struct xypoint screen_center;
 /* Handler to fire when mouse position changes (in master mode) */
 static mousepos_handler_t* mousepos_handler;
 
+/*
+ * Pending scheduled calls are kept in a binary min-heap ordered by call time
+ * (ties broken by scheduling order), each one recording its own position in
+ * the heap so cancel_call() can remove it without searching.
+ */
 struct scheduled_call {
 	void (*fn)(void* arg);
 	void* arg;
 	void (*arg_dtor)(void*);
 	uint64_t calltime;
+	uint64_t seq;
+
+	/* Index in scheduled_calls.heap, or SC_INACTIVE if not pending */
+	size_t heapidx;
+
+	/* Position in sc_pool and reuse count, encoded in its timer_ctx_t */
+	uintptr_t slot, gen;
+
+	/* Freelist link while not in use */
 	struct scheduled_call* next;
 };
 
-static struct scheduled_call* scheduled_calls;
+#define SC_INACTIVE SIZE_MAX
+
+static struct {
+	struct scheduled_call** heap;
+	size_t num, size;
+	uint64_t next_seq;
+} scheduled_calls;
+
+/*
+ * scheduled_call structs are allocated in chunks and recycled via a freelist
+ * instead of being handed back to malloc.  Since a recycled struct gets
+ * handed right back out by the next schedule_call(), a timer_ctx_t isn't a
+ * pointer to one but an encoding of its slot number in the pool along with
+ * its generation (bumped each time it's freed), so that cancel_call() can
+ * recognize (and ignore) a stale handle whose call has already run or been
+ * cancelled instead of cancelling whatever now occupies the slot.
+ */
+#define SC_CHUNK_LEN 32
+
+#define SC_SLOT_BITS (sizeof(uintptr_t) * CHAR_BIT / 2)
+#define SC_SLOT_MASK (((uintptr_t)1 << SC_SLOT_BITS) - 1)
+#define SC_GEN_MASK (UINTPTR_MAX >> SC_SLOT_BITS)
+
+struct sc_chunk {
+	struct scheduled_call calls[SC_CHUNK_LEN];
+};
+
+static struct {
+	struct sc_chunk** chunks;
+	size_t nchunks;
+	struct scheduled_call* freelist;
+} sc_pool;
+
+static struct scheduled_call* alloc_scheduled_call(void)
+{
+	int i;
+	struct sc_chunk* chunk;
+	struct scheduled_call* sc;
+
+	if (!sc_pool.freelist) {
+		/* Slot numbers are stored +1 so that no handle is NULL */
+		if ((sc_pool.nchunks + 1) * SC_CHUNK_LEN >= SC_SLOT_MASK) {
+			errlog("too many scheduled calls\n");
+			abort();
+		}
+		chunk = xmalloc(sizeof(*chunk));
+		for (i = SC_CHUNK_LEN - 1; i >= 0; i--) {
+			chunk->calls[i].heapidx = SC_INACTIVE;
+			chunk->calls[i].slot = sc_pool.nchunks * SC_CHUNK_LEN + i;
+			chunk->calls[i].gen = 0;
+			chunk->calls[i].next = sc_pool.freelist;
+			sc_pool.freelist = &chunk->calls[i];
+		}
+		sc_pool.chunks = xrealloc(sc_pool.chunks, (sc_pool.nchunks + 1)
+		                          * sizeof(*sc_pool.chunks));
+		sc_pool.chunks[sc_pool.nchunks++] = chunk;
+	}
+
+	sc = sc_pool.freelist;
+	sc_pool.freelist = sc->next;
+
+	return sc;
+}
 
 static void free_scheduled_call(struct scheduled_call* sc)
 {
 	if (sc->arg_dtor)
 		sc->arg_dtor(sc->arg);
-	xfree(sc);
+
+	sc->heapidx = SC_INACTIVE;
+	sc->gen = (sc->gen + 1) & SC_GEN_MASK;
+	sc->next = sc_pool.freelist;
+	sc_pool.freelist = sc;
+}
+
+static inline timer_ctx_t sc_handle(const struct scheduled_call* sc)
+{
+	return (timer_ctx_t)((sc->gen << SC_SLOT_BITS) | (sc->slot + 1));
+}
+
+/*
+ * Return the pending call a handle refers to, or NULL if it's stale (or
+ * refers to a pool since freed by clear_scheduled_calls()).
+ */
+static struct scheduled_call* sc_from_handle(timer_ctx_t timer)
+{
+	uintptr_t h = (uintptr_t)timer;
+	uintptr_t slot = (h & SC_SLOT_MASK) - 1;
+	struct scheduled_call* sc;
+
+	if (!(h & SC_SLOT_MASK) || slot / SC_CHUNK_LEN >= sc_pool.nchunks)
+		return NULL;
+
+	sc = &sc_pool.chunks[slot / SC_CHUNK_LEN]->calls[slot % SC_CHUNK_LEN];
+
+	if (sc->gen != h >> SC_SLOT_BITS || sc->heapidx == SC_INACTIVE)
+		return NULL;
+
+	return sc;
+}
+
+static inline int sc_before(const struct scheduled_call* a, const struct scheduled_call* b)
+{
+	return a->calltime < b->calltime
+		|| (a->calltime == b->calltime && a->seq < b->seq);
+}
+
+static inline void sc_heap_set(size_t idx, struct scheduled_call* sc)
+{
+	scheduled_calls.heap[idx] = sc;
+	sc->heapidx = idx;
+}
+
+static void sc_sift_up(size_t idx)
+{
+	size_t parent;
+	struct scheduled_call** heap = scheduled_calls.heap;
+	struct scheduled_call* sc = heap[idx];
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (!sc_before(sc, heap[parent]))
+			break;
+		sc_heap_set(idx, heap[parent]);
+		idx = parent;
+	}
+
+	sc_heap_set(idx, sc);
+}
+
+static void sc_sift_down(size_t idx)
+{
+	size_t child;
+	struct scheduled_call** heap = scheduled_calls.heap;
+	struct scheduled_call* sc = heap[idx];
+
+	while ((child = (2 * idx) + 1) < scheduled_calls.num) {
+		if (child + 1 < scheduled_calls.num && sc_before(heap[child + 1], heap[child]))
+			child += 1;
+		if (!sc_before(heap[child], sc))
+			break;
+		sc_heap_set(idx, heap[child]);
+		idx = child;
+	}
+
+	sc_heap_set(idx, sc);
+}
+
+static void sc_heap_insert(struct scheduled_call* sc)
+{
+	if (scheduled_calls.num == scheduled_calls.size) {
+		scheduled_calls.size = scheduled_calls.size ? scheduled_calls.size * 2 : 16;
+		scheduled_calls.heap = xrealloc(scheduled_calls.heap, scheduled_calls.size
+		                                * sizeof(*scheduled_calls.heap));
+	}
+
+	sc_heap_set(scheduled_calls.num++, sc);
+	sc_sift_up(sc->heapidx);
+}
+
+static void sc_heap_remove(struct scheduled_call* sc)
+{
+	size_t idx = sc->heapidx;
+	struct scheduled_call* last = scheduled_calls.heap[--scheduled_calls.num];
+
+	sc->heapidx = SC_INACTIVE;
+
+	if (last != sc) {
+		sc_heap_set(idx, last);
+		sc_sift_down(idx);
+		sc_sift_up(last->heapidx);
+	}
+}
+
+static inline struct scheduled_call* next_scheduled_call(void)
+{
+	return scheduled_calls.num ? scheduled_calls.heap[0] : NULL;
+}
+
+static void clear_scheduled_calls(void)
+{
+	size_t i;
+
+	for (i = 0; i < scheduled_calls.num; i++) {
+		if (scheduled_calls.heap[i]->arg_dtor)
+			scheduled_calls.heap[i]->arg_dtor(scheduled_calls.heap[i]->arg);
+	}
+
+	xfree(scheduled_calls.heap);
+	scheduled_calls.heap = NULL;
+	scheduled_calls.num = scheduled_calls.size = 0;
+
+	for (i = 0; i < sc_pool.nchunks; i++)
+		xfree(sc_pool.chunks[i]);
+	xfree(sc_pool.chunks);
+	sc_pool.chunks = NULL;
+	sc_pool.nchunks = 0;
+	sc_pool.freelist = NULL;
 }
 
 struct xhotkey {
@@ -451,7 +1114,6 @@ static int xrr_init(void)
 static void xrr_exit(void)
 {
 	int i;
-	struct scheduled_call* sc;
 
 	for (i = 0; i < xrr.resources->ncrtc; i++) {
 		XRRFreeGamma(xrr.crtc_gammas[i].orig);
@@ -461,33 +1123,151 @@ static void xrr_exit(void)
 
 	XRRFreeScreenResources(xrr.resources);
 	XRRFreeScreenConfigInfo(xrr.config);
-
-	while (scheduled_calls) {
-		sc = scheduled_calls;
-		scheduled_calls = sc->next;
-		free_scheduled_call(sc);
-	}
 }
 
-static int xi2_init(void)
-{
-	Status status;
-	unsigned char rawmask[XIMaskLen(XI_LASTEVENT)];
-	int maj = 2, min = 0;
-	XIEventMask ximask;
-
-	if (!XQueryExtension(xdisp, "XInputExtension", &xi2.opcode, &xi2.evbase,
-	                     &xi2.errbase)) {
-		initerr("XInputExtension unavailable\n");
-		return -1;
-	}
+/*
+ * One of the x & y axes of an input device we've received raw motion events
+ * from.  Absolute axes (as on tablets, and the pointers of many virtual
+ * machines) report positions rather than deltas, so for those we also need
+ * the range (to scale to screen coordinates) and the last value seen.
+ */
+struct xi2_axis {
+	int absolute;
+	double min, max;
+	double last;
+	int have_last;
+};
 
-	if (XIQueryVersion(xdisp, &maj, &min)) {
-		initerr("XIQueryVersion() failed\n");
-		return -1;
-	}
+/*
+ * A smooth-scrolling axis of an input device (XInput 2.1), reporting
+ * scrolling in units of 'increment' per wheel click.
+ */
+struct xi2_scroll_axis {
+	int number;
+	double increment;
+	struct xi2_axis axis;
+};
 
-	debug("XInput extension version %d.%d\n", maj, min);
+/* Cached info on an input device (see get_xi2_device()) */
+struct xi2_device {
+	int deviceid;
+
+	/*
+	 * Set for XTest devices, whose "raw" events are just what
+	 * set_mousepos() and the like inject, not real motion.
+	 */
+	int ignore;
+
+	struct xi2_axis axes[2];
+
+	/* Horizontal and vertical scroll axes ('number' is -1 if none) */
+	struct xi2_scroll_axis scroll[2];
+
+	struct xi2_device* next;
+};
+
+static struct xi2_device* xi2_devices;
+
+/* Drop cached device info (e.g. when devices have been added or removed) */
+static void clear_xi2_devices(void)
+{
+	struct xi2_device* dev;
+
+	while (xi2_devices) {
+		dev = xi2_devices;
+		xi2_devices = dev->next;
+		xfree(dev);
+	}
+}
+
+/* Look up the given device, querying the server for it if not yet cached. */
+static struct xi2_device* get_xi2_device(int deviceid)
+{
+	int i, j, ndevs;
+	struct xi2_device* dev;
+	XIDeviceInfo* info;
+	XIValuatorClassInfo* v;
+	XIScrollClassInfo* s;
+
+	for (dev = xi2_devices; dev; dev = dev->next) {
+		if (dev->deviceid == deviceid)
+			return dev;
+	}
+
+	dev = xcalloc(sizeof(*dev));
+	dev->deviceid = deviceid;
+	dev->scroll[0].number = dev->scroll[1].number = -1;
+	dev->next = xi2_devices;
+	xi2_devices = dev;
+
+	info = XIQueryDevice(xdisp, deviceid, &ndevs);
+	if (!info || ndevs < 1) {
+		warn("XIQueryDevice() failed on device %d\n", deviceid);
+		dev->ignore = 1;
+		return dev;
+	}
+
+	dev->ignore = !!strstr(info->name, "XTEST");
+
+	for (i = 0; i < info->num_classes; i++) {
+		if (info->classes[i]->type != XIScrollClass)
+			continue;
+		s = (XIScrollClassInfo*)info->classes[i];
+		if (s->increment == 0.0)
+			continue;
+		j = s->scroll_type == XIScrollTypeVertical;
+		dev->scroll[j].number = s->number;
+		dev->scroll[j].increment = s->increment;
+	}
+
+	for (i = 0; i < info->num_classes; i++) {
+		if (info->classes[i]->type != XIValuatorClass)
+			continue;
+		v = (XIValuatorClassInfo*)info->classes[i];
+		if (v->mode != XIModeAbsolute || v->max <= v->min)
+			continue;
+		if (v->number < ARR_LEN(dev->axes)) {
+			dev->axes[v->number].absolute = 1;
+			dev->axes[v->number].min = v->min;
+			dev->axes[v->number].max = v->max;
+		}
+		for (j = 0; j < ARR_LEN(dev->scroll); j++) {
+			if (dev->scroll[j].number == v->number)
+				dev->scroll[j].axis.absolute = 1;
+		}
+	}
+
+	debug("XInput device %d (%s): %s x axis, %s y axis, %s smooth scrolling%s\n",
+	      deviceid, info->name, dev->axes[0].absolute ? "absolute" : "relative",
+	      dev->axes[1].absolute ? "absolute" : "relative",
+	      (dev->scroll[0].number < 0 && dev->scroll[1].number < 0) ? "no" : "has",
+	      dev->ignore ? " (ignored)" : "");
+
+	XIFreeDeviceInfo(info);
+
+	return dev;
+}
+
+static int xi2_init(void)
+{
+	Status status;
+	unsigned char rawmask[XIMaskLen(XI_LASTEVENT)];
+	unsigned char hiermask[XIMaskLen(XI_LASTEVENT)];
+	int maj = 2, min = 1; /* 2.1 for smooth scrolling */
+	XIEventMask ximasks[2];
+
+	if (!XQueryExtension(xdisp, "XInputExtension", &xi2.opcode, &xi2.evbase,
+	                     &xi2.errbase)) {
+		initerr("XInputExtension unavailable\n");
+		return -1;
+	}
+
+	if (XIQueryVersion(xdisp, &maj, &min)) {
+		initerr("XIQueryVersion() failed\n");
+		return -1;
+	}
+
+	debug("XInput extension version %d.%d\n", maj, min);
 
 	/*
 	 * The Saga of Global Pointer-Tracking under X: a Tale of Woe.
@@ -527,16 +1307,33 @@ static int xi2_init(void)
 	 * effective logical absolute pointer position by summing up all the
 	 * little deltas the raw events give us (and probably doing a crappy
 	 * job of it), we instead just (inefficiently) call XQueryPointer() to
-	 * see what the server thinks every time we get one.  Sigh.  Ugly, but
-	 * at least it works, and doesn't seem to screw up other clients.
+	 * see what the server thinks when we get them.  Sigh.  Ugly, but at
+	 * least it works, and doesn't seem to screw up other clients.
+	 *
+	 * (To keep that from being a round-trip per event with high-rate
+	 * mice, the query is only done once per batch of events, and at
+	 * most once per MOUSEPOS_QUERY_INTERVAL; see flush_mousepos_query().)
+	 *
+	 * When a remote is focused, on the other hand, raw events are just
+	 * what we want, and we use their deltas directly, along with those of
+	 * any smooth-scrolling valuators (hence asking for XInput 2.1); see
+	 * handle_grabbed_rawmotion().  Hierarchy-change events tell us when
+	 * the cached device info that needs has gone stale.
 	 */
 
 	memset(rawmask, 0, sizeof(rawmask));
-	ximask.mask = rawmask;
-	ximask.mask_len = sizeof(rawmask);
-	ximask.deviceid = XIAllMasterDevices;
-	XISetMask(ximask.mask, XI_RawMotion);
-	status = XISelectEvents(xdisp, xrootwin, &ximask, 1);
+	ximasks[0].mask = rawmask;
+	ximasks[0].mask_len = sizeof(rawmask);
+	ximasks[0].deviceid = XIAllMasterDevices;
+	XISetMask(ximasks[0].mask, XI_RawMotion);
+
+	memset(hiermask, 0, sizeof(hiermask));
+	ximasks[1].mask = hiermask;
+	ximasks[1].mask_len = sizeof(hiermask);
+	ximasks[1].deviceid = XIAllDevices;
+	XISetMask(ximasks[1].mask, XI_HierarchyChanged);
+
+	status = XISelectEvents(xdisp, xrootwin, ximasks, ARR_LEN(ximasks));
 
 	return status ? -1 : 0;
 }
@@ -613,6 +1410,16 @@ int platform_init(struct kvmap* params, mousepos_handler_t* mouse_handler)
 	et_selection_data = XInternAtom(xdisp, "ET_SELECTION_DATA", False);
 	utf8_string_atom = XInternAtom(xdisp, "UTF8_STRING", False);
 	targets_atom = XInternAtom(xdisp, "TARGETS", False);
+	incr_atom = XInternAtom(xdisp, "INCR", False);
+
+	/* Needed to receive INCR selection transfers */
+	XSelectInput(xdisp, xwin, PropertyChangeMask);
+
+	/*
+	 * XMaxRequestSize() is in 4-byte units; leave some slack for the
+	 * request header.
+	 */
+	selection_chunk_size = (XMaxRequestSize(xdisp) * 4) - 1024;
 
 	for (i = 0; i < ARR_LEN(clipboard_xatoms); i++) {
 		if (clipboard_xatoms[i].atom == None) {
@@ -654,11 +1461,17 @@ void platform_exit(void)
 	set_display_brightness(1.0);
 
 	xrr_exit();
+	abort_selection_fetch();
+	abort_lazy_selection();
+	while (incr_transfers)
+		free_incr_transfer(incr_transfers);
+	clear_scheduled_calls();
 	XFreeCursor(xdisp, xcursor_blank);
 	XFreePixmap(xdisp, cursor_pixmap);
 	XDestroyWindow(xdisp, xwin);
 	XCloseDisplay(xdisp);
 	x11_keycodes_exit();
+	clear_xi2_devices();
 
 	while (xhotkeys) {
 		hk = xhotkeys;
@@ -715,22 +1528,109 @@ static struct xypoint get_mousepos_and_mask(unsigned int* mask)
 	return pt;
 }
 
+/*
+ * Where we think the pointer is, from the relative moves we've injected
+ * (see move_mousepos()) applied to the last position actually queried from
+ * the server, so that a remote can report where each move leaves the
+ * pointer without a round-trip for every one.  It's only trusted for
+ * PTRMODEL_MAX_AGE after a query (something else could move the pointer,
+ * and the server may accelerate our moves), and not near the screen edges,
+ * where being wrong would mean a missed or spurious edge event.
+ */
+static struct {
+	/* Whether the model is in use at all (i.e. we're injecting moves) */
+	int active;
+
+	struct xypoint pt;
+
+	/* When pt was last queried from the server */
+	uint64_t synced;
+
+	/* Total distance moved (per the model) since then */
+	uint64_t drift;
+} ptrmodel;
+
+#define PTRMODEL_MAX_AGE (50 * 1000) /* 50ms */
+
+/*
+ * How close to a screen edge the modeled position can get before we go
+ * back to querying (or the distance moved since the last query, if that's
+ * larger, since that's roughly how far off the model could be).
+ */
+#define PTRMODEL_EDGE_MARGIN 32
+
+static int64_t edge_distance(struct xypoint pt)
+{
+	int64_t d = (int64_t)pt.x - screen_dimensions.x.min;
+
+	if ((int64_t)screen_dimensions.x.max - pt.x < d)
+		d = (int64_t)screen_dimensions.x.max - pt.x;
+	if ((int64_t)pt.y - screen_dimensions.y.min < d)
+		d = (int64_t)pt.y - screen_dimensions.y.min;
+	if ((int64_t)screen_dimensions.y.max - pt.y < d)
+		d = (int64_t)screen_dimensions.y.max - pt.y;
+
+	return d;
+}
+
+static int ptrmodel_trusted(void)
+{
+	uint64_t margin = ptrmodel.drift > PTRMODEL_EDGE_MARGIN
+		? ptrmodel.drift : PTRMODEL_EDGE_MARGIN;
+
+	return ptrmodel.active
+		&& get_microtime() - ptrmodel.synced < PTRMODEL_MAX_AGE
+		&& edge_distance(ptrmodel.pt) > (int64_t)margin;
+}
+
 struct xypoint get_mousepos(void)
 {
 	unsigned int tmpmask;
-	return get_mousepos_and_mask(&tmpmask);
+	struct xypoint pt;
+
+	if (ptrmodel_trusted())
+		return ptrmodel.pt;
+
+	pt = get_mousepos_and_mask(&tmpmask);
+
+	if (ptrmodel.active) {
+		ptrmodel.pt = pt;
+		ptrmodel.synced = get_microtime();
+		ptrmodel.drift = 0;
+	}
+
+	return pt;
 }
 
 void set_mousepos(struct xypoint pt)
 {
 	XTestFakeMotionEvent(xdisp, -1, pt.x, pt.y, CurrentTime);
-	XFlush(xdisp);
+
+	/* Have the next get_mousepos() check where this actually landed */
+	ptrmodel.synced = 0;
+}
+
+static int32_t clamp_to_range(int64_t v, const range* r)
+{
+	return v < r->min ? r->min : v > r->max ? r->max : v;
 }
 
 void move_mousepos(int32_t dx, int32_t dy)
 {
 	XTestFakeRelativeMotionEvent(xdisp, dx, dy, CurrentTime);
-	XFlush(xdisp);
+
+	if (ptrmodel.active) {
+		ptrmodel.pt.x = clamp_to_range((int64_t)ptrmodel.pt.x + dx,
+		                               &screen_dimensions.x);
+		ptrmodel.pt.y = clamp_to_range((int64_t)ptrmodel.pt.y + dy,
+		                               &screen_dimensions.y);
+		ptrmodel.drift += llabs(dx) + llabs(dy);
+	} else {
+		/* Start modeling, from a fresh query on the next get_mousepos() */
+		ptrmodel.active = 1;
+		ptrmodel.synced = 0;
+	}
+
 	if (mousepos_handler)
 		mousepos_handler(get_mousepos());
 }
@@ -757,7 +1657,6 @@ void do_clickevent(mousebutton_t button, pressrel_t pr)
 {
 	XTestFakeButtonEvent(xdisp, LOOKUP(button, x11_mousebuttons).button,
 	                     pr == PR_PRESS, CurrentTime);
-	XFlush(xdisp);
 
 	/* Update modifier/mousebutton state */
 	if (pr == PR_PRESS)
@@ -766,6 +1665,42 @@ void do_clickevent(mousebutton_t button, pressrel_t pr)
 		xstate &= ~LOOKUP(button, x11_mousebuttons).mask;
 }
 
+/* Core-protocol buttons conventionally used for horizontal scrolling */
+#define ScrollLeftButton 6
+#define ScrollRightButton 7
+
+/*
+ * XTest has no way of injecting smooth-scrolling valuator motion, so
+ * scrolling is emulated with wheel clicks, carrying any fraction of one
+ * over to the next call.
+ */
+void do_scroll(float dx, float dy)
+{
+	static float remainder[2];
+	static const unsigned int buttons[2][2] = {
+		{ ScrollLeftButton, ScrollRightButton, },
+		{ Button4, Button5, },
+	};
+	int i, n;
+
+	remainder[0] += dx;
+	remainder[1] += dy;
+
+	for (i = 0; i < ARR_LEN(remainder); i++) {
+		n = truncf(remainder[i]);
+		remainder[i] -= n;
+		for (; n; n += n < 0 ? 1 : -1) {
+			XTestFakeButtonEvent(xdisp, buttons[i][n > 0], True, CurrentTime);
+			XTestFakeButtonEvent(xdisp, buttons[i][n > 0], False, CurrentTime);
+		}
+	}
+}
+
+void flush_input_events(void)
+{
+	XFlush(xdisp);
+}
+
 static unsigned int modmask_for_xkeycode(KeyCode xkc)
 {
 	KeySym sym = XkbKeycodeToKeysym(xdisp, xkc, 0, 0);
@@ -782,7 +1717,6 @@ void do_keyevent(keycode_t key, pressrel_t pr)
 	KeyCode xkc = keycode_to_xkeycode(xdisp, key);
 
 	XTestFakeKeyEvent(xdisp, xkc, pr == PR_PRESS, CurrentTime);
-	XFlush(xdisp);
 
 	modmask = modmask_for_xkeycode(xkc);
 	if (modmask) {
@@ -805,6 +1739,47 @@ static inline const char* grab_failure_message(int status)
 
 static struct xypoint saved_mousepos;
 
+/*
+ * While a remote is focused, pointer motion is sent to it from the raw
+ * (unaccelerated, unclamped, possibly fractional) deltas of XI_RawMotion
+ * events rather than from core MotionNotify events, which means the
+ * pointer doesn't need to be warped back to the center of the screen all
+ * the time.  Core motion events are still requested when the pointer is
+ * grabbed, and used as before until the first raw event arrives.
+ */
+static struct {
+	/* Whether raw events have taken over for the current grab */
+	int active;
+
+	/* Fractional motion not yet sent */
+	double frac_x, frac_y;
+
+	/*
+	 * Whether scrolling has been seen via smooth-scroll valuators, in
+	 * which case the emulated core button 4-7 events that accompany it
+	 * are ignored.
+	 */
+	int smooth_scroll;
+} rawgrab;
+
+static void reset_rawgrab(void)
+{
+	struct xi2_device* dev;
+	unsigned int i;
+
+	rawgrab.active = 0;
+	rawgrab.frac_x = rawgrab.frac_y = 0.0;
+	rawgrab.smooth_scroll = 0;
+
+	/* Absolute positions from before the grab aren't motion during it */
+	for (dev = xi2_devices; dev; dev = dev->next) {
+		for (i = 0; i < ARR_LEN(dev->axes); i++)
+			dev->axes[i].have_last = 0;
+		for (i = 0; i < ARR_LEN(dev->scroll); i++)
+			dev->scroll[i].axis.have_last = 0;
+	}
+}
+
 #define PointerEventsMask (PointerMotionMask|ButtonPressMask|ButtonReleaseMask)
 
 int grab_inputs(void)
@@ -830,6 +1805,7 @@ int grab_inputs(void)
 	}
 
 	set_mousepos(screen_center);
+	reset_rawgrab();
 
 	XSync(xdisp, False);
 
@@ -871,22 +1847,6 @@ static void get_xevent(XEvent* e)
 	}
 }
 
-static Status send_selection_notify(const XSelectionRequestEvent* req, Atom property)
-{
-	XEvent ev;
-	XSelectionEvent* resp = &ev.xselection;
-
-	resp->type = SelectionNotify;
-	resp->display = req->display;
-	resp->requestor = req->requestor;
-	resp->selection = req->selection;
-	resp->target = req->target;
-	resp->property = property;
-	resp->time = req->time;
-
-	return XSendEvent(xdisp, req->requestor, False, 0, &ev);
-}
-
 static int is_known_clipboard_xatom(Atom atom)
 {
 	int i;
@@ -905,6 +1865,7 @@ static int is_known_clipboard_xatom(Atom atom)
 static void handle_selection_request(const XSelectionRequestEvent* req)
 {
 	Atom property;
+	struct lazy_selreq* r;
 	Atom supported_targets[] = { targets_atom, utf8_string_atom, XA_STRING,  };
 
 	/*
@@ -917,7 +1878,7 @@ static void handle_selection_request(const XSelectionRequestEvent* req)
 	 */
 	property = (req->property == None) ? req->target : req->property;
 
-	if (!clipboard_text
+	if ((!clipboard_text && !lazy_selection.fetch)
 	    || (req->time != CurrentTime && req->time < xselection_owned_since)
 	    || req->owner != xwin || !is_known_clipboard_xatom(req->selection)) {
 		property = None;
@@ -927,10 +1888,18 @@ static void handle_selection_request(const XSelectionRequestEvent* req)
 		                PropModeReplace, (unsigned char*)supported_targets,
 		                ARR_LEN(supported_targets));
 	} else if (req->target == XA_STRING || req->target == utf8_string_atom) {
+		if (!clipboard_text) {
+			/* Answer once the lazily-claimed contents arrive */
+			r = xmalloc(sizeof(*r));
+			r->req = *req;
+			r->next = lazy_selection.reqs;
+			lazy_selection.reqs = r;
+			start_lazy_fetch();
+			return;
+		}
+
 		/* Send the requested data back to the requesting window */
-		XChangeProperty(xdisp, req->requestor, property, req->target, 8,
-		                PropModeReplace, (unsigned char*)clipboard_text,
-		                strlen(clipboard_text));
+		property = send_selection_text(req, property);
 	} else {
 		property = None;
 	}
@@ -940,6 +1909,131 @@ static void handle_selection_request(const XSelectionRequestEvent* req)
 		errlog("Failed to send SelectionNotify to requestor\n");
 }
 
+/*
+ * Append the contents of a format-8 window property to 'sb' (reading it at
+ * most selection_chunk_size bytes at a time), then delete it.  Returns the
+ * property's type -- incr_atom, with nothing appended, if the selection
+ * owner has opted for an INCR transfer -- or None on failure.
+ */
+static Atom read_property_text(Window win, Atom property, struct selbuf* sb)
+{
+	Atom type;
+	int format;
+	long offset = 0;
+	unsigned long nitems, remaining;
+	unsigned char* data;
+
+	do {
+		if (XGetWindowProperty(xdisp, win, property, offset,
+		                       selection_chunk_size / 4, False, AnyPropertyType,
+		                       &type, &format, &nitems, &remaining,
+		                       &data) != Success || type == None)
+			return None;
+
+		if (format != 8) {
+			XFree(data);
+			XDeleteProperty(xdisp, win, property);
+			if (type == incr_atom)
+				return incr_atom;
+			warn("selection window property has unexpected format (%d)\n",
+			     format);
+			return None;
+		}
+
+		selbuf_append(sb, data, nitems);
+		explicit_bzero(data, nitems);
+		XFree(data);
+
+		offset += nitems / 4;
+	} while (remaining);
+
+	XDeleteProperty(xdisp, win, property);
+
+	return type;
+}
+
+static void handle_selection_notify(const XSelectionEvent* sev)
+{
+	Atom type;
+
+	/* Could be a straggler from a fetch that already timed out */
+	if (!selection_fetch.waiters || selection_fetch.incr) {
+		vinfo("unexpected SelectionNotify event\n");
+		return;
+	}
+
+	if (sev->property == None) {
+		finish_selection_fetch(new_clipbuf(xstrdup("")));
+		return;
+	}
+
+	if (sev->selection != clipboard_xatoms[0].atom)
+		warn("unexpected selection (%lu) in SelectionNotify event\n",
+		     sev->selection);
+	if (sev->property != et_selection_data)
+		warn("unexpected property (%lu) in SelectionNotify event\n",
+		     sev->property);
+	if (sev->requestor != xwin)
+		warn("unexpected requestor (%lu) in SelectionNotify event\n",
+		     sev->requestor);
+	if (sev->target != XA_STRING && sev->target != utf8_string_atom)
+		warn("unexpected target (%lu) in SelectionNotify event\n",
+		     sev->target);
+
+	type = read_property_text(sev->requestor, sev->property, &selection_fetch.buf);
+
+	if (type == incr_atom) {
+		/* The data will arrive piecemeal, announced by PropertyNotify events */
+		selection_fetch.incr = 1;
+		set_selection_timeout(INCR_TIMEOUT_US);
+		return;
+	}
+
+	if (type != None && type != XA_STRING && type != utf8_string_atom)
+		warn("selection window property has unexpected type (%lu)\n", type);
+
+	finish_selection_fetch(selbuf_take(&selection_fetch.buf));
+}
+
+/* Receive the next piece of an incoming INCR transfer. */
+static void handle_incr_chunk(void)
+{
+	size_t prevlen = selection_fetch.buf.len;
+	Atom type = read_property_text(xwin, et_selection_data, &selection_fetch.buf);
+
+	if (type == None || type == incr_atom) {
+		errlog("INCR selection transfer failed\n");
+		finish_selection_fetch(new_clipbuf(xstrdup("")));
+	} else if (selection_fetch.buf.len == prevlen) {
+		/* A zero-length chunk marks the end of the transfer */
+		finish_selection_fetch(selbuf_take(&selection_fetch.buf));
+	} else {
+		set_selection_timeout(INCR_TIMEOUT_US);
+	}
+}
+
+static void handle_property_notify(const XPropertyEvent* pev)
+{
+	struct incr_transfer* xfer;
+
+	if (pev->window == xwin) {
+		if (selection_fetch.incr && pev->atom == et_selection_data
+		    && pev->state == PropertyNewValue)
+			handle_incr_chunk();
+		return;
+	}
+
+	if (pev->state != PropertyDelete)
+		return;
+
+	for (xfer = incr_transfers; xfer; xfer = xfer->next) {
+		if (xfer->requestor == pev->window && xfer->property == pev->atom) {
+			send_incr_chunk(xfer);
+			return;
+		}
+	}
+}
+
 static void handle_keyevent(XKeyEvent* kev, pressrel_t pr)
 {
 	KeySym sym;
@@ -970,6 +2064,10 @@ static inline void update_last_mousepos(XMotionEvent* mev)
 
 static void handle_grabbed_mousemove(XMotionEvent* mev)
 {
+	/* Stragglers from before handle_grabbed_rawmotion() took over */
+	if (rawgrab.active)
+		return;
+
 	if (mev->x_root == screen_center.x
 	    && mev->y_root == screen_center.y)
 		return;
@@ -995,26 +2093,216 @@ static void handle_local_mousemove(XMotionEvent* mev)
 	update_last_mousepos(mev);
 }
 
-static void handle_rawmotion(XIRawEvent* rev)
+/*
+ * Minimum time between pointer-position queries made in response to raw
+ * motion events.  This is well below what anyone could notice in an edge
+ * switch, but cuts the round-trips from a 1000Hz mouse by a factor of four.
+ */
+#define MOUSEPOS_QUERY_INTERVAL (4 * 1000) /* 4ms */
+
+/*
+ * Whether raw motion events have been received since the pointer position
+ * was last queried, when that was, and the scheduled call to do the next
+ * query if it's been deferred to keep to MOUSEPOS_QUERY_INTERVAL.
+ */
+static struct {
+	int pending;
+	uint64_t last;
+	timer_ctx_t timer;
+} mousepos_query;
+
+static void process_events(void);
+
+static void query_mousepos(void)
 {
 	unsigned int mask;
 	struct xypoint pt;
 
-	if (mousepos_handler) {
-		/*
-		 * It's kind of sad that we're querying the server to retrieve
-		 * the mouse position every time we receive a motion event,
-		 * but every other approach I've tried has problems.  See the
-		 * lengthy comment in xi2_init() for details.
-		 *
-		 * FIXME: should also avoid calling the handler if some other
-		 * client has a keyboard or pointer grab -- unfortunately, I
-		 * don't see a simple way of determining whether or not that's
-		 * the case short of just trying to grab them...
-		 */
-		pt = get_mousepos_and_mask(&mask);
-		if (!mask)
-			mousepos_handler(pt);
+	mousepos_query.pending = 0;
+	mousepos_query.last = get_microtime();
+
+	/*
+	 * It's kind of sad that we're querying the server to retrieve the
+	 * mouse position whenever it moves, but every other approach I've
+	 * tried has problems.  See the lengthy comment in xi2_init() for
+	 * details.
+	 *
+	 * FIXME: should also avoid calling the handler if some other client
+	 * has a keyboard or pointer grab -- unfortunately, I don't see a
+	 * simple way of determining whether or not that's the case short of
+	 * just trying to grab them...
+	 */
+	pt = get_mousepos_and_mask(&mask);
+	if (!mask)
+		mousepos_handler(pt);
+}
+
+static void mousepos_query_cb(void* arg)
+{
+	mousepos_query.timer = NULL;
+
+	/* This does the query, and then handles anything it left queued. */
+	process_events();
+}
+
+/*
+ * Query the pointer position if it's moved since the last query, or if
+ * that was too recent, schedule a call to do so once it isn't.  Since
+ * every query just returns wherever the pointer is at that moment, all the
+ * motion events in a batch are covered by one query at the end of it; and
+ * any deferred query still sees where the pointer ended up.
+ */
+static void flush_mousepos_query(void)
+{
+	uint64_t now, due;
+
+	if (!mousepos_query.pending || mousepos_query.timer)
+		return;
+
+	now = get_microtime();
+	due = mousepos_query.last + MOUSEPOS_QUERY_INTERVAL;
+
+	if (now >= due)
+		query_mousepos();
+	else
+		mousepos_query.timer = schedule_call(mousepos_query_cb, NULL, NULL,
+		                                     due - now);
+}
+
+/*
+ * Return the motion (in screen pixels) a raw event's value for the given
+ * axis represents.
+ */
+static double axis_motion(struct xi2_axis* axis, double value, int32_t screen_size)
+{
+	double delta;
+
+	if (!axis->absolute)
+		return value;
+
+	delta = axis->have_last
+		? (value - axis->last) * screen_size / (axis->max - axis->min)
+		: 0.0;
+
+	axis->last = value;
+	axis->have_last = 1;
+
+	return delta;
+}
+
+/*
+ * Return the scrolling (in wheel clicks) a raw event's value for the given
+ * scroll axis represents.
+ */
+static double scroll_motion(struct xi2_scroll_axis* s, double value)
+{
+	double delta;
+
+	/* Scroll valuators are usually relative in raw events, but not always */
+	if (!s->axis.absolute)
+		return value / s->increment;
+
+	delta = s->axis.have_last ? (value - s->axis.last) / s->increment : 0.0;
+
+	s->axis.last = value;
+	s->axis.have_last = 1;
+
+	return delta;
+}
+
+/*
+ * Send pointer motion and smooth scrolling to the focused remote from a
+ * raw motion event.
+ */
+static void handle_grabbed_rawmotion(XIRawEvent* rev)
+{
+	int i, j;
+	double d[2] = { 0.0, 0.0, }, scroll[2] = { 0.0, 0.0, };
+	const double* raw = rev->raw_values;
+	struct xi2_device* dev = get_xi2_device(rev->sourceid);
+	int32_t dx, dy, sizes[2] = {
+		screen_dimensions.x.max - screen_dimensions.x.min + 1,
+		screen_dimensions.y.max - screen_dimensions.y.min + 1,
+	};
+
+	if (dev->ignore)
+		return;
+
+	/* raw_values has an entry for each axis set in the mask, in order */
+	for (i = 0; i < rev->valuators.mask_len * 8; i++) {
+		if (!XIMaskIsSet(rev->valuators.mask, i))
+			continue;
+		if (i < ARR_LEN(dev->axes))
+			d[i] = axis_motion(&dev->axes[i], *raw, sizes[i]);
+		for (j = 0; j < ARR_LEN(dev->scroll); j++) {
+			if (dev->scroll[j].number == i)
+				scroll[j] = scroll_motion(&dev->scroll[j], *raw);
+		}
+		raw++;
+	}
+
+	if (scroll[0] != 0.0 || scroll[1] != 0.0) {
+		rawgrab.smooth_scroll = 1;
+		send_scroll(focused_node->remote, scroll[0], scroll[1]);
+	}
+
+	if (!rawgrab.active) {
+		/* We're covered now; stop core motion events for this grab. */
+		XChangeActivePointerGrab(xdisp, PointerEventsMask & ~PointerMotionMask,
+		                         xcursor_blank, CurrentTime);
+		rawgrab.active = 1;
+	}
+
+	rawgrab.frac_x += d[0];
+	rawgrab.frac_y += d[1];
+	dx = trunc(rawgrab.frac_x);
+	dy = trunc(rawgrab.frac_y);
+	rawgrab.frac_x -= dx;
+	rawgrab.frac_y -= dy;
+
+	if (dx || dy)
+		send_moverel(focused_node->remote, dx, dy);
+}
+
+static void handle_rawmotion(XIRawEvent* rev)
+{
+	if (!mousepos_handler)
+		return;
+
+	if (is_remote(focused_node))
+		handle_grabbed_rawmotion(rev);
+	else
+		mousepos_query.pending = 1;
+}
+
+static void handle_buttonevent(XButtonEvent* bev, pressrel_t pr)
+{
+	if (!is_remote(focused_node)) {
+		vinfo("%s with no focused remote\n",
+		      pr == PR_PRESS ? "ButtonPress" : "ButtonRelease");
+		return;
+	}
+
+	switch (bev->button) {
+	case Button4:
+	case Button5:
+	case ScrollLeftButton:
+	case ScrollRightButton:
+		/* Already sent via handle_grabbed_rawmotion() */
+		if (rawgrab.smooth_scroll)
+			return;
+		break;
+	}
+
+	if (bev->button == ScrollLeftButton || bev->button == ScrollRightButton) {
+		if (pr == PR_PRESS)
+			send_scroll(focused_node->remote,
+			            bev->button == ScrollLeftButton ? -1.0 : 1.0, 0.0);
+	} else if (bev->button < ARR_LEN(pi_mousebuttons) && bev->button != 0) {
+		send_clickevent(focused_node->remote,
+		                LOOKUP(bev->button, pi_mousebuttons), pr);
+	} else {
+		debug("ignoring unsupported mouse button %u\n", bev->button);
 	}
 }
 
@@ -1040,21 +2328,11 @@ static void handle_event(XEvent* ev)
 		break;
 
 	case ButtonPress:
-		if (!is_remote(focused_node))
-			vinfo("ButtonPress with no focused remote\n");
-		else
-			send_clickevent(focused_node->remote,
-			                LOOKUP(ev->xbutton.button, pi_mousebuttons),
-			                PR_PRESS);
+		handle_buttonevent(&ev->xbutton, PR_PRESS);
 		break;
 
 	case ButtonRelease:
-		if (!is_remote(focused_node))
-			vinfo("ButtonRelease with no focused remote\n");
-		else
-			send_clickevent(focused_node->remote,
-			                LOOKUP(ev->xbutton.button, pi_mousebuttons),
-			                PR_RELEASE);
+		handle_buttonevent(&ev->xbutton, PR_RELEASE);
 		break;
 
 	case SelectionRequest:
@@ -1065,11 +2343,16 @@ static void handle_event(XEvent* ev)
 		if (ev->xselectionclear.window == xwin
 		    && is_known_clipboard_xatom(ev->xselectionclear.selection)) {
 			clear_clipboard_cache();
+			drop_lazy_selection();
 		}
 		break;
 
 	case SelectionNotify:
-		vinfo("unexpected SelectionNotify event\n");
+		handle_selection_notify(&ev->xselection);
+		break;
+
+	case PropertyNotify:
+		handle_property_notify(&ev->xproperty);
 		break;
 
 	case GenericEvent:
@@ -1078,10 +2361,12 @@ static void handle_event(XEvent* ev)
 		else if (!XGetEventData(xdisp, &ev->xcookie))
 			vinfo("XGetEventData() failed on xi2 GenericEvent\n");
 		else {
-			if (ev->xcookie.evtype != XI_RawMotion)
-				vinfo("unexpected xi2 evtype: %d\n", ev->xcookie.evtype);
-			else
+			if (ev->xcookie.evtype == XI_RawMotion)
 				handle_rawmotion(ev->xcookie.data);
+			else if (ev->xcookie.evtype == XI_HierarchyChanged)
+				clear_xi2_devices();
+			else
+				vinfo("unexpected xi2 evtype: %d\n", ev->xcookie.evtype);
 			XFreeEventData(xdisp, &ev->xcookie);
 		}
 		break;
@@ -1117,101 +2402,65 @@ static void process_events(void)
 {
 	XEvent ev;
 
-	while (XPending(xdisp)) {
-		get_xevent(&ev);
-		handle_event(&ev);
-	}
+	/* The position query can leave more events queued, so go around again */
+	do {
+		while (XPending(xdisp)) {
+			get_xevent(&ev);
+			handle_event(&ev);
+		}
+		flush_mousepos_query();
+	} while (XQLength(xdisp));
 }
 
-/* The longest we'll wait for a SelectionNotify event before giving up */
-#define SELECTION_TIMEOUT_US 100000
-
-char* get_clipboard_text(void)
+void get_clipboard_text(clipboard_text_callback_t cb, void* arg)
 {
-	XEvent ev;
-	Atom selection_atom = clipboard_xatoms[0].atom;
-	Atom proptype;
-	int propformat;
-	unsigned long nitems, bytes_remaining;
-	unsigned char* prop;
-	char* text;
-	uint64_t before;
+	struct clipboard_waiter* w;
+	int in_progress = selection_fetch.waiters != NULL;
+
+	if (lazy_selection.fetch) {
+		w = xmalloc(sizeof(*w));
+		w->cb = cb;
+		w->arg = arg;
+		w->next = lazy_selection.waiters;
+		lazy_selection.waiters = w;
+		start_lazy_fetch();
+		return;
+	}
 
 	/*
 	 * If we (think we) own the selection, just go ahead and use it
 	 * without going through all the X crap.
 	 */
-	if (xselection_owned_since != 0 && clipboard_text)
-		return xstrdup(clipboard_text);
-
-	/* FIXME: delete et_selection_data from xwin before requestion conversion */
-	XConvertSelection(xdisp, selection_atom, utf8_string_atom, et_selection_data,
-	                  xwin, last_xevent_time);
-	XFlush(xdisp);
-
-	before = get_microtime();
-
-	while (get_microtime() - before < SELECTION_TIMEOUT_US) {
-		get_xevent(&ev);
-		if (ev.type != SelectionNotify) {
-			handle_event(&ev);
-			continue;
-		}
+	if (xselection_owned_since != 0 && clipboard_text) {
+		cb(clipbuf_get(clipboard_text), arg);
+		return;
+	}
 
-		if (ev.xselection.property == None)
-			return xstrdup("");
-
-		if (ev.xselection.selection != selection_atom)
-			warn("unexpected selection (%lu) in SelectionNotify event\n",
-			     ev.xselection.selection);
-		if (ev.xselection.property != et_selection_data)
-			warn("unexpected property (%lu) in SelectionNotify event\n",
-			     ev.xselection.property);
-		if (ev.xselection.requestor != xwin)
-			warn("unexpected requestor (%lu) in SelectionNotify event\n",
-			     ev.xselection.requestor);
-		if (ev.xselection.target != XA_STRING && ev.xselection.target != utf8_string_atom)
-			warn("unexpected target (%lu) in SelectionNotify event\n",
-			     ev.xselection.target);
-
-		XGetWindowProperty(ev.xselection.display, ev.xselection.requestor,
-		                   ev.xselection.property, 0, (1L << 24), True,
-		                   AnyPropertyType, &proptype, &propformat, &nitems,
-		                   &bytes_remaining, &prop);
-
-		if (proptype != XA_STRING && proptype != utf8_string_atom)
-			warn("selection window property has unexpected type (%lu)\n",
-			     proptype);
-		if (bytes_remaining)
-			warn("%lu bytes remaining of selection window property\n",
-			     bytes_remaining);
-		if (propformat != 8) {
-			warn("selection window property has unexpected format (%d)\n",
-			     propformat);
-			return xstrdup("");
-		}
+	w = xmalloc(sizeof(*w));
+	w->cb = cb;
+	w->arg = arg;
+	w->next = NULL;
+	*selection_fetch.tail = w;
+	selection_fetch.tail = &w->next;
 
-		text = xmalloc(nitems + 1);
-		memcpy(text, prop, nitems);
-		text[nitems] = '\0';
+	if (in_progress)
+		return;
 
-		XFree(prop);
-		return text;
-	}
+	XDeleteProperty(xdisp, xwin, et_selection_data);
+	XConvertSelection(xdisp, clipboard_xatoms[0].atom, utf8_string_atom,
+	                  et_selection_data, xwin, last_xevent_time);
+	XFlush(xdisp);
 
-	errlog("timed out waiting for selection\n");
-	return xstrdup("");
+	set_selection_timeout(SELECTION_TIMEOUT_US);
 }
 
-int set_clipboard_text(const char* text)
+/* Take ownership of all the selections we handle. */
+static int claim_selection(void)
 {
 	int i;
 	Atom atom;
 	Window newowner;
 
-	clear_clipboard_cache();
-	clipboard_text = xstrdup(text);
-
 	for (i = 0; i < ARR_LEN(clipboard_xatoms); i++) {
 		atom = clipboard_xatoms[i].atom;
 		XSetSelectionOwner(xdisp, atom, xwin, CurrentTime);
@@ -1228,6 +2477,41 @@ int set_clipboard_text(const char* text)
 	return 0;
 }
 
+int set_clipboard_text(struct clipbuf* text)
+{
+	/* Take our reference first, in case it's what we already have */
+	clipbuf_get(text);
+	clear_clipboard_cache();
+	clipboard_text = text;
+
+	/* These may be the contents of a lazy claim we're waiting on */
+	lazy_selection.fetch = NULL;
+	finish_lazy_fetch(1);
+
+	return claim_selection();
+}
+
+int set_clipboard_lazy(clipboard_fetch_fn_t fetch, void* arg)
+{
+	clear_clipboard_cache();
+	drop_lazy_selection();
+
+	lazy_selection.fetch = fetch;
+	lazy_selection.arg = arg;
+
+	if (claim_selection()) {
+		lazy_selection.fetch = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int clipboard_is_lazy(void)
+{
+	return lazy_selection.fetch != NULL;
+}
+
 static MAKE_GAMMA_SCALE_FN(gamma_scale, unsigned short, lrintf);
 
 static void scale_gamma(const XRRCrtcGamma* from, XRRCrtcGamma* to, float f)
@@ -1256,45 +2540,34 @@ void set_display_brightness(float f)
 
 timer_ctx_t schedule_call(void (*fn)(void* arg), void* arg, void (*arg_dtor)(void*), uint64_t delay)
 {
-	struct scheduled_call* call;
-	struct scheduled_call** prevnext;
-	struct scheduled_call* newcall = xmalloc(sizeof(*newcall));
+	struct scheduled_call* newcall = alloc_scheduled_call();
 
 	newcall->fn = fn;
 	newcall->arg = arg;
 	newcall->arg_dtor = arg_dtor;
 	newcall->calltime = get_microtime() + delay;
+	newcall->seq = scheduled_calls.next_seq++;
 
-	for (prevnext = &scheduled_calls, call = *prevnext;
-	     call;
-	     prevnext = &call->next, call = call->next) {
-		if (newcall->calltime < call->calltime)
-			break;
-	}
-
-	newcall->next = call;
-	*prevnext = newcall;
+	sc_heap_insert(newcall);
 
-	return newcall;
+	return sc_handle(newcall);
 }
 
+/*
+ * Cancel a pending call, returning 1 if it was, or 0 if it had already run
+ * or been cancelled (see the comment above SC_CHUNK_LEN).
+ */
 int cancel_call(timer_ctx_t timer)
 {
-	struct scheduled_call* call;
-	struct scheduled_call** prevnext;
-	struct scheduled_call* target = timer;
-
-	for (prevnext = &scheduled_calls, call = *prevnext;
-	     call;
-	     prevnext = &call->next, call = call->next) {
-		if (call == target) {
-			*prevnext = call->next;
-			free_scheduled_call(call);
-			return 1;
-		}
-	}
+	struct scheduled_call* call = sc_from_handle(timer);
 
-	return 0;
+	if (!call)
+		return 0;
+
+	sc_heap_remove(call);
+	free_scheduled_call(call);
+
+	return 1;
 }
 
 struct fdmon_ctx {
@@ -1304,21 +2577,137 @@ struct fdmon_ctx {
 	uint32_t flags;
 	int refcount;
 
+	/*
+	 * With epoll these link together the ctxs registered on the same fd;
+	 * with select() they link all registered ctxs.
+	 */
 	struct fdmon_ctx* next;
 	struct fdmon_ctx* prev;
+
+#ifdef USE_EPOLL
+	/* Readiness reported by the current epoll_wait() round */
+	uint32_t revents;
+	struct fdmon_ctx* ready_next;
+#endif
 };
 
-static struct {
-	struct fdmon_ctx* head;
-	struct fdmon_ctx* tail;
-} monitored_fds = {
-	.head = NULL,
-	.tail = NULL,
+#ifdef USE_EPOLL
+
+/*
+ * More than one fdmon_ctx can be registered on a given fd (msgchans using a
+ * single socket for both directions do this), but epoll only allows one
+ * registration per fd, so we keep a table indexed by fd tracking the ctxs on
+ * each one and the union of their interest sets as currently registered with
+ * the kernel.
+ */
+struct epoll_fdent {
+	struct fdmon_ctx* ctxs;
+	uint32_t events;
 };
 
+static int epoll_fd = -1;
+static struct epoll_fdent* epoll_fdtab;
+static int epoll_fdtab_size;
+
+/* Whether the X connection's fd has been added to epoll_fd yet */
+static int epoll_xfd_added;
+
+/*
+ * timerfd used to wake epoll_wait() for scheduled calls, and the call time
+ * it's currently armed for (0 if disarmed).
+ */
+static int timer_fd = -1;
+static uint64_t timer_fd_armed;
+
+#define EPOLL_MAXEVENTS 64
+
+static int get_epoll_fd(void)
+{
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			perror("epoll_create1");
+			exit(1);
+		}
+	}
+
+	return epoll_fd;
+}
+
+static struct epoll_fdent* get_epoll_fdent(int fd)
+{
+	int newsize;
+
+	if (fd >= epoll_fdtab_size) {
+		newsize = epoll_fdtab_size ? epoll_fdtab_size : 16;
+		while (newsize <= fd)
+			newsize *= 2;
+		epoll_fdtab = xrealloc(epoll_fdtab, newsize * sizeof(*epoll_fdtab));
+		memset(epoll_fdtab + epoll_fdtab_size, 0,
+		       (newsize - epoll_fdtab_size) * sizeof(*epoll_fdtab));
+		epoll_fdtab_size = newsize;
+	}
+
+	return &epoll_fdtab[fd];
+}
+
+static void epoll_modify(int op, int fd, uint32_t events)
+{
+	struct epoll_event ev = { .events = events, .data.fd = fd, };
+
+	if (epoll_ctl(get_epoll_fd(), op, fd, &ev)) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+}
+
+/* Bring the kernel's interest set for 'fd' in line with its ctxs' flags. */
+static void epoll_update_fd(int fd)
+{
+	struct fdmon_ctx* ctx;
+	struct epoll_fdent* ent = get_epoll_fdent(fd);
+	uint32_t events = 0;
+
+	for (ctx = ent->ctxs; ctx; ctx = ctx->next) {
+		if (ctx->flags & FM_READ)
+			events |= EPOLLIN;
+		if (ctx->flags & FM_WRITE)
+			events |= EPOLLOUT;
+	}
+
+	if (events == ent->events)
+		return;
+
+	if (!ent->events)
+		epoll_modify(EPOLL_CTL_ADD, fd, events);
+	else if (!events)
+		epoll_modify(EPOLL_CTL_DEL, fd, 0);
+	else
+		epoll_modify(EPOLL_CTL_MOD, fd, events);
+
+	ent->events = events;
+}
+
+static struct fdmon_ctx** fdmon_listhead(int fd)
+{
+	return &get_epoll_fdent(fd)->ctxs;
+}
+
+#else
+
+static struct fdmon_ctx* monitored_fds = NULL;
+
+static struct fdmon_ctx** fdmon_listhead(int fd)
+{
+	return &monitored_fds;
+}
+
+#endif /* USE_EPOLL */
+
 struct fdmon_ctx* fdmon_register_fd(int fd, fdmon_callback_t readcb,
                                     fdmon_callback_t writecb, void* arg)
 {
+	struct fdmon_ctx** head = fdmon_listhead(fd);
 	struct fdmon_ctx* ctx = xmalloc(sizeof(*ctx));
 
 	ctx->fd = fd;
@@ -1328,16 +2717,13 @@ struct fdmon_ctx* fdmon_register_fd(int fd, fdmon_callback_t readcb,
 	ctx->flags = 0;
 	ctx->refcount = 1;
 
-	ctx->next = monitored_fds.head;
+	ctx->next = *head;
 	if (ctx->next)
 		ctx->next->prev = ctx;
-	monitored_fds.head = ctx;
+	*head = ctx;
 
 	ctx->prev = NULL;
 
-	if (!monitored_fds.tail)
-		monitored_fds.tail = ctx;
-
 	return ctx;
 }
 
@@ -1350,10 +2736,7 @@ static void fdmon_unref(struct fdmon_ctx* ctx)
 		return;
 
 	if (!ctx->prev)
-		monitored_fds.head = ctx->next;
-
-	if (!ctx->next)
-		monitored_fds.tail = ctx->prev;
+		*fdmon_listhead(ctx->fd) = ctx->next;
 
 	if (ctx->next)
 		ctx->next->prev = ctx->prev;
@@ -1384,6 +2767,9 @@ void fdmon_monitor(struct fdmon_ctx* ctx, uint32_t flags)
 	}
 
 	ctx->flags |= flags;
+#ifdef USE_EPOLL
+	epoll_update_fd(ctx->fd);
+#endif
 }
 
 void fdmon_unmonitor(struct fdmon_ctx* ctx, uint32_t flags)
@@ -1394,26 +2780,168 @@ void fdmon_unmonitor(struct fdmon_ctx* ctx, uint32_t flags)
 	}
 
 	ctx->flags &= ~flags;
+#ifdef USE_EPOLL
+	epoll_update_fd(ctx->fd);
+#endif
 }
 
 static void run_scheduled_calls(uint64_t when)
 {
 	struct scheduled_call* call;
 
-	while (scheduled_calls && scheduled_calls->calltime <= when) {
-		call = scheduled_calls;
-		scheduled_calls = call->next;
+	while ((call = next_scheduled_call()) && call->calltime <= when) {
+		sc_heap_remove(call);
 		call->fn(call->arg);
 		free_scheduled_call(call);
 	}
 }
 
+#ifdef USE_EPOLL
+
+/*
+ * Arm (or disarm) timer_fd for the next pending scheduled call, so it wakes
+ * epoll_wait() at the right time.
+ */
+static void update_timer_fd(void)
+{
+	uint64_t delay, now_us;
+	struct itimerspec its = { .it_interval = { 0, 0, }, .it_value = { 0, 0, }, };
+	struct scheduled_call* next = next_scheduled_call();
+	uint64_t calltime = next ? next->calltime : 0;
+
+	if (calltime == timer_fd_armed)
+		return;
+
+	if (timer_fd < 0) {
+		timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (timer_fd < 0) {
+			perror("timerfd_create");
+			exit(1);
+		}
+		epoll_modify(EPOLL_CTL_ADD, timer_fd, EPOLLIN);
+	}
+
+	if (next) {
+		now_us = get_microtime();
+		/* An all-zero it_value would disarm it, so wait at least 1us */
+		delay = calltime > now_us ? calltime - now_us : 1;
+		its.it_value.tv_sec = delay / 1000000;
+		its.it_value.tv_nsec = (delay % 1000000) * 1000;
+	}
+
+	if (timerfd_settime(timer_fd, 0, &its, NULL)) {
+		perror("timerfd_settime");
+		exit(1);
+	}
+
+	timer_fd_armed = calltime;
+}
+
+/* Consume a timer_fd expiration. */
+static void ack_timer_fd(void)
+{
+	uint64_t expirations;
+
+	if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+		perror("read(timer_fd)");
+		exit(1);
+	}
+
+	/*
+	 * get_microtime()'s clock and timer_fd's can differ slightly, so the
+	 * next call may not quite be due yet; mark it disarmed so we re-arm it
+	 * for whatever time remains.
+	 */
+	timer_fd_armed = 0;
+}
+
+static void handle_fds(void)
+{
+	int i, nevents;
+	uint32_t revents;
+	uint64_t now_us;
+	struct epoll_event events[EPOLL_MAXEVENTS];
+	struct fdmon_ctx* mfd;
+	struct fdmon_ctx* ready = NULL;
+	int xready = 0, xfd = xdisp ? XConnectionNumber(xdisp) : -1;
+
+	now_us = get_microtime();
+
+	run_scheduled_calls(now_us);
+
+	if (xfd >= 0 && !epoll_xfd_added) {
+		epoll_modify(EPOLL_CTL_ADD, xfd, EPOLLIN);
+		epoll_xfd_added = 1;
+	}
+
+	update_timer_fd();
+
+	nevents = epoll_wait(get_epoll_fd(), events, ARR_LEN(events), -1);
+	if (nevents < 0) {
+		if (errno != EINTR) {
+			perror("epoll_wait");
+			exit(1);
+		}
+		nevents = 0;
+	}
+
+	/*
+	 * Collect (and ref) every ctx with something to do before running any
+	 * callbacks, since callbacks could unregister other ctxs, including
+	 * ones we've yet to get to.  Errors and hangups are reported as both
+	 * readable and writable, matching what select() would say.
+	 */
+	for (i = 0; i < nevents; i++) {
+		if (events[i].data.fd == xfd) {
+			xready = 1;
+			continue;
+		} else if (events[i].data.fd == timer_fd) {
+			ack_timer_fd();
+			continue;
+		}
+
+		revents = 0;
+		if (events[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP))
+			revents |= FM_READ;
+		if (events[i].events & (EPOLLOUT|EPOLLERR|EPOLLHUP))
+			revents |= FM_WRITE;
+
+		for (mfd = get_epoll_fdent(events[i].data.fd)->ctxs; mfd; mfd = mfd->next) {
+			if (!(mfd->flags & revents))
+				continue;
+			fdmon_ref(mfd);
+			mfd->revents = revents;
+			mfd->ready_next = ready;
+			ready = mfd;
+		}
+	}
+
+	while (ready) {
+		mfd = ready;
+		ready = mfd->ready_next;
+
+		if ((mfd->flags & FM_READ) && (mfd->revents & FM_READ))
+			mfd->readcb(mfd, mfd->arg);
+
+		if ((mfd->flags & FM_WRITE) && (mfd->revents & FM_WRITE))
+			mfd->writecb(mfd, mfd->arg);
+
+		fdmon_unref(mfd);
+	}
+
+	if (xready)
+		process_events();
+}
+
+#else
+
 static struct timeval* get_select_timeout(struct timeval* tv, uint64_t now_us)
 {
 	uint64_t maxwait_us;
+	struct scheduled_call* next = next_scheduled_call();
 
-	if (scheduled_calls) {
-		maxwait_us = scheduled_calls->calltime - now_us;
+	if (next) {
+		maxwait_us = next->calltime - now_us;
 		tv->tv_sec = maxwait_us / 1000000;
 		tv->tv_usec = maxwait_us % 1000000;
 		return tv;
@@ -1442,7 +2970,7 @@ static void handle_fds(void)
 	if (xfd >= 0)
 		fdset_add(xfd, &rfds, &nfds);
 
-	for (mfd = monitored_fds.head; mfd; mfd = mfd->next) {
+	for (mfd = monitored_fds; mfd; mfd = mfd->next) {
 		if (mfd->flags & FM_READ)
 			fdset_add(mfd->fd, &rfds, &nfds);
 		if (mfd->flags & FM_WRITE)
@@ -1455,7 +2983,7 @@ static void handle_fds(void)
 		exit(1);
 	}
 
-	for (mfd = monitored_fds.head; mfd; mfd = next_mfd) {
+	for (mfd = monitored_fds; mfd; mfd = next_mfd) {
 		/*
 		 * Callbacks could unregister mfd, so we ref/unref it around
 		 * the body of this loop
@@ -1476,6 +3004,8 @@ static void handle_fds(void)
 		process_events();
 }
 
+#endif /* USE_EPOLL */
+
 void run_event_loop(void)
 {
 	for (;;)